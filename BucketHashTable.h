@@ -2,74 +2,528 @@
 #define UNTITLED3_BUCKETHASHTABLE_H
 
 #include <cstddef>
+#include <atomic>
 #include <memory>
 #include <optional>
+#include <ranges>
+#include <span>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <array>
 #include <iostream>
 #include <cassert>
+#include <algorithm>
+#include <cstdlib>
+#include <new>
 #include "Hash.h"
-#include "PrimeNumbers.h"
+#include "CapacityPolicy.h"
+#include "NodePool.h"
+#include "HugePageAllocator.h"
+#include "Entry.h"
+#include "Prefetch.h"
+#include "Stats.h"
+#include "RehashExecutor.h"
+#include "TableIterator.h"
 
 static constexpr double bucket_default_load_factor_limit = 0.8;
 
-template<typename K, typename V, template<typename> typename H, double load_factor_limit = bucket_default_load_factor_limit> requires Hash<H, K>
+// rehash moves every bucket inside the insert that crosses the load factor limit
+struct StopTheWorldResize {
+    static constexpr std::size_t buckets_per_step = 0;
+};
+
+// rehash only allocates the new bucket array, then every insert, find and remove moves
+// the next buckets_per_step buckets of the old array; lookups check both meanwhile
+template<std::size_t step = 8>
+struct IncrementalResize {
+    static constexpr std::size_t buckets_per_step = step;
+};
+
+template<typename K, typename V, template<typename> typename H, double load_factor_limit = bucket_default_load_factor_limit,
+        typename Capacity = PrimeCapacity, typename Resize = StopTheWorldResize,
+        typename Allocator = std::allocator<std::pair<const K, V>>,
+        typename Stats = NoStats> requires Hash<H, K>
 class BucketHashTable {
 private:
     struct Node {
-        std::pair<const K, V> kv;
+        template<typename... Args>
+        explicit Node(std::size_t key_hash, Args &&... args) : hash(key_hash), next(nullptr) {
+            entry.construct(std::forward<Args>(args)...);
+        }
+
+        ~Node() requires std::is_trivially_destructible_v<std::pair<K, V>> = default;
+
+        ~Node() {
+            entry.destroy();
+        }
+
+        Entry<K, V> entry;
+        [[no_unique_address]] StoredHash<stores_hash<K>> hash;
         Node *next;
+    };
+
+    using NodeAllocator = typename std::allocator_traits<Allocator>::template rebind_alloc<Node>;
+    using NodeTraits = std::allocator_traits<NodeAllocator>;
+    using ArrayAllocator = typename std::allocator_traits<Allocator>::template rebind_alloc<Node *>;
+
+    // Walks the chains of bucket positions [b, end): the new array, then the old one while an
+    // incremental resize is pending. Inserts and removes invalidate it.
+    template<typename Value>
+    class ChainIterator {
+        template<typename> friend class ChainIterator;
+
+    public:
+        using value_type = std::remove_const_t<Value>;
+        using difference_type = std::ptrdiff_t;
+        using reference = Value &;
+        using pointer = Value *;
+        using iterator_category = std::forward_iterator_tag;
+
+        ChainIterator() = default;
+
+        ChainIterator(const BucketHashTable *table, std::size_t b, std::size_t end) :
+                table(table), node(b < end ? table->bucket(b) : nullptr), b(b), end(end) {
+            skip_empty();
+        }
+
+        // iterator to const_iterator
+        template<typename OtherValue>
+        requires std::is_convertible_v<OtherValue *, Value *>
+        ChainIterator(const ChainIterator<OtherValue> &other) :
+                table(other.table), node(other.node), b(other.b), end(other.end) {}
+
+        reference operator*() const {
+            return node->entry.kv;
+        }
+
+        pointer operator->() const {
+            return &node->entry.kv;
+        }
+
+        ChainIterator &operator++() {
+            node = node->next;
+            skip_empty();
+            return *this;
+        }
+
+        ChainIterator operator++(int) {
+            ChainIterator result = *this;
+            ++*this;
+            return result;
+        }
+
+        bool operator==(const ChainIterator &other) const {
+            return node == other.node;
+        }
 
-        explicit Node(std::pair<const K, V> &&kv) : kv(kv), next(nullptr) {}
+    private:
+        void skip_empty() {
+            while (!node && ++b < end) {
+                node = table->bucket(b);
+            }
+        }
+
+        const BucketHashTable *table = nullptr;
+        Node *node = nullptr;
+        std::size_t b = 0;
+        std::size_t end = 0;
     };
 
 public:
-    BucketHashTable() : size_i(0),
-                        fullness_size(0),
-                        nodes(new Node *[prime_numbers[0]]),
-                        hash(H < K > {}) {
-        std::fill(nodes, nodes + prime_numbers[0], nullptr);
+    using key_type = K;
+    using mapped_type = V;
+    using hasher = H<K>;
+    using find_result = std::optional<std::reference_wrapper<std::pair<const K, V>>>;
+    using iterator = ChainIterator<std::pair<const K, V>>;
+    using const_iterator = ChainIterator<const std::pair<const K, V>>;
+    using capacity_sized = void;
+
+    // find moves old buckets while an incremental resize is pending, or records into the stats
+    static constexpr bool mutating_find = Resize::buckets_per_step != 0 || Stats::enabled;
+
+    explicit BucketHashTable(const Allocator &allocator = Allocator()) : size_i(0),
+                                                                         fullness_size(0),
+                                                                         old_size_i(0),
+                                                                         migrated(0),
+                                                                         node_allocator(allocator),
+                                                                         nodes(allocate_buckets(Capacity::size(0))),
+                                                                         old_nodes(nullptr),
+                                                                         hash(H < K > {}) {}
+
+    template<std::ranges::input_range R>
+    requires std::constructible_from<std::pair<const K, V>, std::ranges::range_reference_t<R>> &&
+             (!std::same_as<std::remove_cvref_t<R>, BucketHashTable>)
+    explicit BucketHashTable(R &&range, const Allocator &allocator = Allocator()) :
+            BucketHashTable(allocator) {
+        insert_range(std::forward<R>(range));
     }
 
+    BucketHashTable(const BucketHashTable &) = delete;
+
+    BucketHashTable &operator=(const BucketHashTable &) = delete;
+
     bool insert(std::pair<const K, V> &&kv) {
-        if (load_factor() >= load_factor_limit) {
-            rehash();
+        return emplace_key(kv.first, std::move(kv.second));
+    }
+
+    // the pair is built first to get at its key, which is then moved into the table
+    template<typename... Args>
+    bool emplace(Args &&... args) {
+        std::pair<K, V> kv(std::forward<Args>(args)...);
+        return emplace_key(std::move(kv.first), std::move(kv.second));
+    }
+
+    // the value is constructed from args in place, and only if the key is absent
+    template<typename... Args>
+    bool try_emplace(const K &key, Args &&... args) {
+        return emplace_key(key, std::forward<Args>(args)...);
+    }
+
+    template<typename... Args>
+    bool try_emplace(K &&key, Args &&... args) {
+        return emplace_key(std::move(key), std::forward<Args>(args)...);
+    }
+
+    // false when the key was present and only its value was assigned
+    template<typename M>
+    bool insert_or_assign(const K &key, M &&value) {
+        return assign_key(key, std::forward<M>(value));
+    }
+
+    template<typename M>
+    bool insert_or_assign(K &&key, M &&value) {
+        return assign_key(std::move(key), std::forward<M>(value));
+    }
+
+    // a sized range is reserved for once and inserted without per element load factor checks
+    template<std::ranges::input_range R>
+    requires std::constructible_from<std::pair<const K, V>, std::ranges::range_reference_t<R>>
+    void insert_range(R &&range) {
+        if constexpr (std::ranges::sized_range<R>) {
+            reserve(fullness() + std::ranges::size(range));
+
+            for (auto &&kv: range) {
+                std::pair<K, V> entry(std::forward<decltype(kv)>(kv));
+                emplace_without_rehash(std::move(entry.first), std::move(entry.second));
+            }
+        } else {
+            for (auto &&kv: range) {
+                emplace(std::forward<decltype(kv)>(kv));
+            }
         }
+    }
+
+    // grows the table so that n entries fit below the load factor limit, the move into
+    // the new bucket array is done at once even in incremental mode
+    void reserve(std::size_t n) {
+        std::size_t new_size_i = fitting_size_index<Capacity>(n, load_factor_limit);
 
-        return insert_without_rehash(std::move(kv));
+        if (new_size_i > size_i) {
+            rehash(new_size_i);
+            migrate_all();
+        }
     }
 
-    std::optional<std::reference_wrapper<std::pair<const K, V>>> find(const K &key, std::size_t &probes_count) {
-        std::size_t h = hash(key) % size();
-        Node *node = nodes[h];
+    // shrinks to the smallest capacity that holds the entries below the load factor limit
+    void shrink_to_fit() {
+        std::size_t new_size_i = std::min(size_i, fitting_size_index<Capacity>(fullness(), load_factor_limit));
+
+        if (new_size_i < size_i) {
+            rehash(new_size_i);
+            migrate_all();
+        }
+    }
+
+    // a remove that leaves the load factor below min_load_factor shrinks the table to where the
+    // entries fill half the limit; 0, the default, never shrinks. Capped at a quarter of the
+    // limit, so that neither a grow nor another shrink follows right away.
+    void set_shrink_load_factor(double min_load_factor) {
+        shrink_load_factor = std::min(min_load_factor, load_factor_limit / 4);
+    }
+
+    template<LookupKey<H, K> Q = K>
+    std::optional<std::reference_wrapper<std::pair<const K, V>>> find(const Q &key, std::size_t &probes_count) {
+        const auto &lookup_key = as_lookup_key<H, K>(key);
+
+        migrate(Resize::buckets_per_step);
+        return find_from(lookup_key, hash(lookup_key), probes_count);
+    }
+
+    template<LookupKey<H, K> Q = K>
+    find_result find(const Q &key) {
+        std::size_t probes_count = 0;
+        return find(key, probes_count);
+    }
+
+    template<LookupKey<H, K> Q = K>
+    bool contains(const Q &key) {
+        std::size_t probes_count = 0;
+        return find(key, probes_count).has_value();
+    }
+
+    // hashes a group of keys and prefetches their buckets and first nodes before walking
+    // any chain, so the cache misses of the group overlap instead of being paid one by one
+    void find_batch(std::span<const K> keys, std::vector<find_result> &results, std::size_t &probes_count) {
+        migrate(Resize::buckets_per_step);
+
+        results.resize(keys.size());
+        std::array<std::size_t, prefetch_batch_width> key_hashes;
+        std::array<std::size_t, prefetch_batch_width> buckets;
+
+        for (std::size_t begin = 0; begin < keys.size(); begin += prefetch_batch_width) {
+            std::size_t count = std::min(prefetch_batch_width, keys.size() - begin);
+
+            for (std::size_t j = 0; j < count; ++j) {
+                key_hashes[j] = hash(keys[begin + j]);
+                buckets[j] = Capacity::reduce(key_hashes[j], size_i);
+                prefetch(nodes + buckets[j]);
+            }
+
+            for (std::size_t j = 0; j < count; ++j) {
+                prefetch(nodes[buckets[j]]);
+            }
+
+            for (std::size_t j = 0; j < count; ++j) {
+                results[begin + j] = find_from(keys[begin + j], key_hashes[j], probes_count);
+            }
+        }
+    }
+
+    void find_batch(std::span<const K> keys, std::vector<find_result> &results) {
+        std::size_t probes_count = 0;
+        find_batch(keys, results, probes_count);
+    }
+
+    template<LookupKey<H, K> Q = K>
+    std::optional<std::pair<K, V>> remove(const Q &key) {
+        const auto &lookup_key = as_lookup_key<H, K>(key);
+
+        migrate(Resize::buckets_per_step);
+
+        std::size_t key_hash = hash(lookup_key);
+        auto kv = remove_from_chain(nodes[Capacity::reduce(key_hash, size_i)], key_hash, lookup_key);
+
+        if (!kv && migrating(key_hash)) {
+            kv = remove_from_chain(old_nodes[Capacity::reduce(key_hash, old_size_i)], key_hash, lookup_key);
+        }
+
+        if (kv) {
+            shrink_if_sparse();
+        }
+
+        return kv;
+    }
+
+    inline double load_factor() const {
+        return static_cast<double>(fullness()) / static_cast<double>(size());
+    }
+
+    inline std::size_t fullness() const {
+        return fullness_size;
+    }
+
+    inline std::size_t size() const {
+        return Capacity::size(size_i);
+    }
+
+    // moving the old array all at once is split over the executor from parallel_rehash_min_size
+    // buckets on: every stop the world rehash, and the end of a pending incremental one
+    void set_rehash_executor(RehashExecutor executor) {
+        rehash_executor = std::move(executor);
+    }
+
+    // lookup and rehash counters stay zero unless the table collects stats
+    TableStats stats() {
+        TableStats result = stats_policy.snapshot();
+        result.allocated_bytes = (size() + (old_nodes ? Capacity::size(old_size_i) : 0)) * sizeof(Node *) +
+                                 fullness() * sizeof(Node);
+
+        return result;
+    }
+
+    // entries bucket by bucket, those still in the old array after the new one's
+    iterator begin() {
+        return {this, 0, positions()};
+    }
+
+    iterator end() {
+        return {this, positions(), positions()};
+    }
+
+    const_iterator begin() const {
+        return {this, 0, positions()};
+    }
+
+    const_iterator end() const {
+        return {this, positions(), positions()};
+    }
+
+    // fn(kv) for every entry, the buckets of both arrays split over threads
+    template<typename F>
+    void parallel_for_each(F fn, std::size_t threads = std::thread::hardware_concurrency()) {
+        parallel_for_each_position<iterator>(this, positions(), fn, threads);
+    }
+
+    void debug() {
+        debug_buckets(nodes, size());
+
+        if (old_nodes) {
+            debug_buckets(old_nodes, Capacity::size(old_size_i));
+        }
+
+        std::cout << std::endl;
+    }
+
+    ~BucketHashTable() {
+        delete_buckets(nodes, size());
+
+        if (old_nodes) {
+            delete_buckets(old_nodes, Capacity::size(old_size_i));
+        }
+    }
+
+private:
+    // buckets of the new array, followed by those of the old one
+    inline std::size_t positions() const {
+        return size() + (old_nodes ? Capacity::size(old_size_i) : 0);
+    }
+
+    inline Node *bucket(std::size_t b) const {
+        return b < size() ? nodes[b] : old_nodes[b - size()];
+    }
+
+    template<typename Q>
+    find_result find_from(const Q &key, std::size_t key_hash, std::size_t &probes_count) {
+        std::size_t first_probe = probes_count;
+        find_result result = probe_from(key, key_hash, probes_count);
+
+        stats_policy.record_lookup(result.has_value(), probes_count - first_probe);
+        return result;
+    }
+
+    template<typename Q>
+    find_result probe_from(const Q &key, std::size_t key_hash, std::size_t &probes_count) {
+        Node *node = find_in_chain(nodes[Capacity::reduce(key_hash, size_i)], key_hash, key, probes_count);
+
+        if (!node && migrating(key_hash)) {
+            node = find_in_chain(old_nodes[Capacity::reduce(key_hash, old_size_i)], key_hash, key, probes_count);
+        }
+
+        if (node) {
+            return {std::ref(node->entry.kv)};
+        }
+
+        return {};
+    }
+
+    static void debug_buckets(Node **buckets, std::size_t size) {
+        for (std::size_t i = 0; i < size; i++) {
+            Node *node = buckets[i];
+
+            while (node) {
+                std::cout << node->entry.kv.first << " " << node->entry.kv.second << "\n";
+                node = node->next;
+            }
+        }
+    }
+
+    void delete_buckets(Node **buckets, std::size_t size) {
+        // the pool drops its blocks at once, there is nothing to run per node
+        if constexpr (!(releases_all_at_once_v<NodeAllocator> && std::is_trivially_destructible_v<Node>)) {
+            for (std::size_t i = 0; i < size; ++i) {
+                Node *node = buckets[i];
+                while (node != nullptr) {
+                    Node *temp = node;
+                    node = node->next;
+                    delete_node(temp);
+                }
+            }
+        }
+        deallocate_buckets(buckets, size);
+    }
+
+    template<typename... Args>
+    Node *new_node(Args &&... args) {
+        Node *node = NodeTraits::allocate(node_allocator, 1);
+        NodeTraits::construct(node_allocator, node, std::forward<Args>(args)...);
+        return node;
+    }
+
+    void delete_node(Node *node) {
+        NodeTraits::destroy(node_allocator, node);
+        NodeTraits::deallocate(node_allocator, node, 1);
+    }
+
+    // calloc takes large arrays as fresh zeroed pages from the OS, so a new bucket array is not
+    // written up front and clearing it is spread over the first accesses of its pages; it
+    // stands in for std::allocator only, other allocators are used and cleared after
+    static constexpr bool calloc_buckets = std::is_same_v<ArrayAllocator, std::allocator<Node *>>;
+
+    Node **allocate_buckets(std::size_t size) {
+        if constexpr (calloc_buckets) {
+            if (void *p = std::calloc(size, sizeof(Node *))) {
+                return static_cast<Node **>(p);
+            }
+
+            throw std::bad_alloc();
+        } else {
+            Node **buckets = ArrayAllocator(node_allocator).allocate(size);
+
+            if constexpr (!allocates_zeroed_v<ArrayAllocator>) {
+                std::fill(buckets, buckets + size, nullptr);
+            }
+
+            return buckets;
+        }
+    }
+
+    void deallocate_buckets(Node **buckets, std::size_t size) {
+        if constexpr (calloc_buckets) {
+            std::free(buckets);
+        } else {
+            ArrayAllocator(node_allocator).deallocate(buckets, size);
+        }
+    }
 
+    // the stored hash is compared first, the key only on a match
+    template<typename Q>
+    static bool matches(const Node *node, std::size_t key_hash, const Q &key) {
+        return node->hash.matches(key_hash) && node->entry.kv.first == key;
+    }
+
+    template<typename Q>
+    static Node *find_in_chain(Node *node, std::size_t key_hash, const Q &key, std::size_t &probes_count) {
         while (node != nullptr) {
             ++probes_count;
 
-            if (node->kv.first == key) {
-                return {std::ref(node->kv)};
+            if (matches(node, key_hash, key)) {
+                return node;
             }
 
             node = node->next;
         }
 
-        return {};
+        return nullptr;
     }
 
-    std::optional<std::pair<K, V>> remove(const K &key) {
-        std::size_t h = hash(key) % size();
-        Node *node = nodes[h];
+    template<typename Q>
+    std::optional<std::pair<K, V>> remove_from_chain(Node *&head, std::size_t key_hash, const Q &key) {
+        Node *node = head;
         Node *prev = nullptr;
 
         while (node != nullptr) {
-            if (node->kv.first == key) {
-                std::pair<K, V> kv = std::move(node->kv);
+            if (matches(node, key_hash, key)) {
+                std::pair<K, V> kv = node->entry.extract();
 
                 if (prev == nullptr) {
-                    nodes[h] = node->next;
+                    head = node->next;
                 } else {
                     prev->next = node->next;
                 }
 
-                delete node;
+                delete_node(node);
                 --fullness_size;
 
                 return {std::move(kv)};
@@ -82,84 +536,151 @@ public:
         return {};
     }
 
-    inline double load_factor() const {
-        return static_cast<double>(fullness()) / static_cast<double>(size());
+    // the key's bucket of the old array has not been moved yet
+    inline bool migrating(std::size_t key_hash) {
+        return old_nodes && Capacity::reduce(key_hash, old_size_i) >= migrated;
     }
 
-    inline std::size_t fullness() const {
-        return fullness_size;
-    }
+    // moves up to `buckets` buckets of the old array by relinking their nodes
+    void migrate(std::size_t buckets) {
+        if (!old_nodes) {
+            return;
+        }
 
-    inline std::size_t size() const {
-        return prime_numbers[size_i];
+        std::size_t old_size = Capacity::size(old_size_i);
+        std::size_t end = std::min(old_size, migrated + buckets);
+
+        relink<false>(migrated, end);
+        migrated = end;
+
+        if (migrated == old_size) {
+            deallocate_buckets(old_nodes, old_size);
+            old_nodes = nullptr;
+        }
     }
 
-    void debug() {
-        for (int i = 0; i < size(); i++) {
-            Node *node = nodes[i];
+    // the rest of the old array, in ranges on the executor if there is one
+    void migrate_all() {
+        std::size_t old_size = Capacity::size(old_size_i);
 
-            while (node) {
-                std::cout << node->kv.first << " " << node->kv.second << "\n";
-                node = node->next;
-            }
+        if (old_nodes && rehash_executor && old_size - migrated >= parallel_rehash_min_size) {
+            std::size_t first = migrated;
+
+            parallel_ranges(rehash_executor, old_size - first, [&](std::size_t begin, std::size_t end) {
+                relink<true>(first + begin, first + end);
+            });
+
+            migrated = old_size;
         }
 
-        std::cout << std::endl;
+        migrate(old_size);
     }
 
-    ~BucketHashTable() {
-        for (std::size_t i = 0; i < size(); ++i) {
-            Node *node = nodes[i];
+    // Pushes the nodes of old buckets [begin, end) onto the chains of the new array, by CAS on
+    // the chain head while other ranges are relinked at once. Nodes are only ever pushed, the
+    // executor's join publishes the chains.
+    template<bool concurrent>
+    void relink(std::size_t begin, std::size_t end) {
+        for (std::size_t b = begin; b < end; ++b) {
+            Node *node = old_nodes[b];
+
             while (node != nullptr) {
-                Node *temp = node;
-                node = node->next;
-                delete temp;
+                Node *next = node->next;
+                std::size_t h = Capacity::reduce(node->hash.get(node->entry.kv.first, hash), size_i);
+
+                if constexpr (concurrent) {
+                    std::atomic_ref<Node *> head(nodes[h]);
+                    node->next = head.load(std::memory_order_relaxed);
+
+                    while (!head.compare_exchange_weak(node->next, node, std::memory_order_relaxed)) {}
+                } else {
+                    node->next = nodes[h];
+                    nodes[h] = node;
+                }
+
+                node = next;
             }
+
+            old_nodes[b] = nullptr;
         }
-        delete[] nodes;
     }
 
-private:
-    void rehash() {
-        std::size_t old_size = size();
-        size_i++;
-        fullness_size = 0;
+    // after a remove, see set_shrink_load_factor; an incremental resize stays incremental
+    void shrink_if_sparse() {
+        if (load_factor() < shrink_load_factor) {
+            std::size_t new_size_i = fitting_size_index<Capacity>(2 * fullness(), load_factor_limit);
 
-        Node **buff = new Node *[size()];
-        std::fill(buff, buff + size(), nullptr);
+            if (new_size_i < size_i) {
+                rehash(new_size_i);
+            }
+        }
+    }
 
-        std::swap(buff, nodes);
+    void rehash(std::size_t new_size_i) {
+        typename Stats::RehashTimer timer(stats_policy);
+        // an unfinished migration is completed first
+        migrate_all();
 
-        for (std::size_t i = 0; i < old_size; ++i) {
-            Node *node = buff[i];
+        old_nodes = nodes;
+        old_size_i = size_i;
+        size_i = new_size_i;
+        migrated = 0;
 
-            while (node != nullptr) {
-                insert_without_rehash(std::move(node->kv));
+        nodes = allocate_buckets(size());
 
-                Node *node_to_delete = node;
-                node = node->next;
+        // stop the world relinks every node right away, entries are never copied
+        if constexpr (Resize::buckets_per_step == 0) {
+            migrate_all();
+        }
+    }
 
-                delete node_to_delete;
-            }
+    template<typename KK, typename... Args>
+    bool emplace_key(KK &&key, Args &&... args) {
+        migrate(Resize::buckets_per_step);
+
+        if (load_factor() >= load_factor_limit) {
+            rehash(next_size_index<Capacity>(size_i));
         }
 
-        delete[] buff;
+        return emplace_without_rehash(std::forward<KK>(key), std::forward<Args>(args)...);
     }
 
-    bool insert_without_rehash(std::pair<const K, V> &&kv) {
-        std::size_t h = hash(kv.first) % size();
+    template<typename KK, typename M>
+    bool assign_key(KK &&key, M &&value) {
+        std::size_t probes_count = 0;
+
+        if (auto kv = find(key, probes_count)) {
+            kv->get().second = std::forward<M>(value);
+            return false;
+        }
+
+        return emplace_key(std::forward<KK>(key), std::forward<M>(value));
+    }
+
+    template<typename KK, typename... Args>
+    bool emplace_without_rehash(KK &&key, Args &&... args) {
+        std::size_t key_hash = hash(key);
+        std::size_t h = Capacity::reduce(key_hash, size_i);
         Node *node = nodes[h];
 
         while (node != nullptr) {
-            if (node->kv.first == kv.first) {
+            if (matches(node, key_hash, key)) {
                 return false;
             }
             node = node->next;
         }
 
-        Node *new_node = new Node(std::move(kv));
-        new_node->next = nodes[h];
-        nodes[h] = new_node;
+        std::size_t probes_count = 0;
+
+        if (migrating(key_hash) &&
+            find_in_chain(old_nodes[Capacity::reduce(key_hash, old_size_i)], key_hash, key, probes_count)) {
+            return false;
+        }
+
+        Node *node_to_insert = new_node(key_hash, std::piecewise_construct, std::forward_as_tuple(std::forward<KK>(key)),
+                                        std::forward_as_tuple(std::forward<Args>(args)...));
+        node_to_insert->next = nodes[h];
+        nodes[h] = node_to_insert;
 
         ++fullness_size;
         return true;
@@ -168,9 +689,18 @@ private:
     std::size_t size_i;
     std::size_t fullness_size;
 
+    std::size_t old_size_i;
+    std::size_t migrated;
+
+    NodeAllocator node_allocator;
+
     Node **nodes;
+    Node **old_nodes;
 
     H <K> hash;
+    RehashExecutor rehash_executor;
+    double shrink_load_factor = 0;
+    [[no_unique_address]] Stats stats_policy;
 };
 
 #endif //UNTITLED3_BUCKETHASHTABLE_H
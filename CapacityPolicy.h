@@ -0,0 +1,77 @@
+#ifndef UNTITLED3_CAPACITYPOLICY_H
+#define UNTITLED3_CAPACITYPOLICY_H
+
+#include <cstddef>
+#include <stdexcept>
+#include "PrimeNumbers.h"
+
+// Capacity policies pick the table size for a growth step i and reduce a hash to a slot.
+// step(h, i) returns a double hashing step for the home slot h that is coprime with size(i).
+
+// Prime sizes growing by numerator / denominator per step up to the largest 64-bit prime,
+// reduction by multiply and shift instead of a division. Smaller steps waste less memory
+// past the last rehash and need less during one, for more frequent rehashes.
+template<std::size_t numerator = 2, std::size_t denominator = 1>
+struct PrimeGrowthCapacity {
+    static constexpr std::size_t count = prime_numbers_count<numerator, denominator>;
+
+    static constexpr std::size_t size(std::size_t i) {
+        return prime_numbers<numerator, denominator>[i];
+    }
+
+    static constexpr std::size_t reduce(std::size_t h, std::size_t i) {
+        return fastmod(h, prime_magic_numbers<numerator, denominator>[i], size(i));
+    }
+
+    // 1 + h % (size - 1) for h < size
+    static constexpr std::size_t step(std::size_t h, std::size_t i) {
+        return h + 1 < size(i) ? h + 1 : 1;
+    }
+};
+
+using PrimeCapacity = PrimeGrowthCapacity<>;
+
+// Power of two sizes, reduction by a mask. Only the low bits of the hash are used,
+// so it has to be paired with a hasher that mixes them well.
+struct PowerOfTwoCapacity {
+    static constexpr std::size_t count = 58;
+
+    static constexpr std::size_t size(std::size_t i) {
+        return std::size_t{64} << i;
+    }
+
+    static constexpr std::size_t reduce(std::size_t h, std::size_t i) {
+        return h & (size(i) - 1);
+    }
+
+    static constexpr std::size_t step(std::size_t h, std::size_t) {
+        return h | 1;
+    }
+};
+
+// smallest growth step that holds n entries below the load factor limit,
+// std::length_error if even the last one does not
+template<typename Capacity>
+constexpr std::size_t fitting_size_index(std::size_t n, double load_factor_limit) {
+    std::size_t i = 0;
+
+    while (static_cast<double>(n) >= load_factor_limit * static_cast<double>(Capacity::size(i))) {
+        if (++i == Capacity::count) {
+            throw std::length_error("hash table capacity exhausted");
+        }
+    }
+
+    return i;
+}
+
+// the growth step after i, std::length_error past the last one
+template<typename Capacity>
+constexpr std::size_t next_size_index(std::size_t i) {
+    if (i + 1 >= Capacity::count) {
+        throw std::length_error("hash table capacity exhausted");
+    }
+
+    return i + 1;
+}
+
+#endif //UNTITLED3_CAPACITYPOLICY_H
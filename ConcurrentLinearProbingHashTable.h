@@ -0,0 +1,488 @@
+#ifndef UNTITLED3_CONCURRENTLINEARPROBINGHASHTABLE_H
+#define UNTITLED3_CONCURRENTLINEARPROBINGHASHTABLE_H
+
+#include <cstddef>
+#include <algorithm>
+#include <atomic>
+#include <concepts>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <cassert>
+#include "Hash.h"
+#include "CapacityPolicy.h"
+#include "Prefetch.h"
+#include "EpochReclaimer.h"
+
+static constexpr double concurrent_default_load_factor_limit = 0.5;
+
+// Lock-free linear probing for integral keys and values. Every slot is an atomic key and
+// an atomic value. A key is claimed once by a CAS and never leaves its slot, so the probe
+// sequence of a key never changes; removing only swaps the value for a tombstone.
+//
+// Growing allocates the next table and marks every old slot moved once its entry has been
+// copied. Threads that run into the resize migrate chunks of the old table before going
+// on; an operation that reaches a moved slot repeats itself in the next table. Old tables
+// are freed by an EpochReclaimer once no operation can still be inside them. find never
+// writes to the table and never waits, only an insert of a new key can wait for a
+// migration it keeps helping with.
+//
+// The largest key and the three largest values are reserved for slot states, insert throws
+// std::invalid_argument for them.
+template<std::integral K, std::integral V, template<typename> typename H,
+        double load_factor_limit = concurrent_default_load_factor_limit,
+        typename Capacity = PrimeCapacity> requires Hash<H, K>
+class ConcurrentLinearHashingHashTable {
+public:
+    using key_type = K;
+    using mapped_type = V;
+    using hasher = H<K>;
+
+    static constexpr K empty_key = std::numeric_limits<K>::max();
+    static constexpr V empty_value = std::numeric_limits<V>::max();
+    static constexpr V tombstone = empty_value - 1;
+    static constexpr V moved = empty_value - 2;
+
+    ConcurrentLinearHashingHashTable() : current(new Table(0)), hash(H < K > {}) {}
+
+    ConcurrentLinearHashingHashTable(const ConcurrentLinearHashingHashTable &) = delete;
+
+    ConcurrentLinearHashingHashTable &operator=(const ConcurrentLinearHashingHashTable &) = delete;
+
+    bool insert(std::pair<const K, V> &&kv) {
+        if (kv.first == empty_key || !live(kv.second)) {
+            throw std::invalid_argument("reserved key or value");
+        }
+
+        auto guard = reclaimer.pin();
+
+        for (Table *t = current.load(std::memory_order_acquire);; t = t->next.load(std::memory_order_acquire)) {
+            help_migrate(t);
+
+            Slot *slot = claim(t, kv.first);
+
+            if (!slot) {
+                continue;
+            }
+
+            V value = slot->value.load(std::memory_order_acquire);
+
+            while (value != moved) {
+                if (live(value)) {
+                    return false;
+                }
+
+                // a removed key coming back is a new entry to copy as well, uncounted
+                // before the check like new keys in claim
+                if (value == tombstone) {
+                    t->removed.fetch_sub(1, std::memory_order_seq_cst);
+
+                    if (!takes_new_keys(t)) {
+                        t->removed.fetch_add(1, std::memory_order_relaxed);
+                        help_migrate(current.load(std::memory_order_acquire));
+                        std::this_thread::yield();
+                        value = slot->value.load(std::memory_order_acquire);
+                        continue;
+                    }
+
+                    if (slot->value.compare_exchange_weak(value, kv.second, std::memory_order_acq_rel)) {
+                        return true;
+                    }
+
+                    t->removed.fetch_add(1, std::memory_order_relaxed);
+                    continue;
+                }
+
+                if (slot->value.compare_exchange_weak(value, kv.second, std::memory_order_acq_rel)) {
+                    return true;
+                }
+            }
+        }
+    }
+
+    std::optional<V> find(const K &key) {
+        auto guard = reclaimer.pin();
+
+        for (Table *t = current.load(std::memory_order_acquire); t; t = t->next.load(std::memory_order_acquire)) {
+            Slot *slot = lookup(t, key);
+
+            if (!slot) {
+                continue;
+            }
+
+            V value = slot->value.load(std::memory_order_acquire);
+
+            if (value != moved) {
+                return live(value) ? std::optional<V>(value) : std::nullopt;
+            }
+        }
+
+        return {};
+    }
+
+    std::optional<std::pair<K, V>> remove(const K &key) {
+        auto guard = reclaimer.pin();
+
+        for (Table *t = current.load(std::memory_order_acquire); t; t = t->next.load(std::memory_order_acquire)) {
+            help_migrate(t);
+
+            Slot *slot = lookup(t, key);
+
+            if (!slot) {
+                continue;
+            }
+
+            V value = slot->value.load(std::memory_order_acquire);
+
+            while (value != moved) {
+                if (!live(value)) {
+                    return {};
+                }
+
+                if (slot->value.compare_exchange_weak(value, tombstone, std::memory_order_acq_rel)) {
+                    t->removed.fetch_add(1, std::memory_order_relaxed);
+                    return {{key, value}};
+                }
+            }
+        }
+
+        return {};
+    }
+
+    // counts the live entries of the tables in use, exact only while no thread writes
+    std::size_t fullness() {
+        auto guard = reclaimer.pin();
+        std::size_t result = 0;
+
+        for (Table *t = current.load(std::memory_order_acquire); t; t = t->next.load(std::memory_order_acquire)) {
+            for (std::size_t i = 0; i < t->size(); ++i) {
+                result += live(t->slots[i].value.load(std::memory_order_acquire));
+            }
+        }
+
+        return result;
+    }
+
+    inline std::size_t size() {
+        auto guard = reclaimer.pin();
+        return current.load(std::memory_order_acquire)->size();
+    }
+
+    // rebuilds the table at the smallest capacity its entries fill to half the load factor
+    // limit, without tombstones, and returns once it is in use; other threads go on finding,
+    // removing and updating meanwhile, inserts of new keys wait for the smaller table. A resize
+    // to another size started by another thread is waited for and the new table measured.
+    void shrink_to_fit() {
+        for (;;) {
+            auto guard = reclaimer.pin();
+            Table *t = current.load(std::memory_order_acquire);
+            // none while another resize is pending
+            std::size_t new_size_i = Capacity::count;
+
+            if (!t->next.load(std::memory_order_acquire)) {
+                // new keys wait from before the counts are read until the next table is in place
+                t->shrinking.fetch_add(1, std::memory_order_seq_cst);
+
+                struct Shrinking {
+                    ~Shrinking() {
+                        table->shrinking.fetch_sub(1, std::memory_order_release);
+                    }
+
+                    Table *table;
+                } shrinking{t};
+
+                std::size_t removed = t->removed.load(std::memory_order_seq_cst);
+                std::size_t non_removed_size = t->used.load(std::memory_order_seq_cst) - removed;
+                new_size_i = std::min(t->size_i, fitting_size_index<Capacity>(2 * non_removed_size, load_factor_limit));
+
+                if (new_size_i == t->size_i && removed == 0) {
+                    return;
+                }
+
+                start_resize(t, new_size_i);
+            }
+
+            Table *next = t->next.load(std::memory_order_acquire);
+
+            while (current.load(std::memory_order_acquire) == t) {
+                help_migrate(t);
+                std::this_thread::yield();
+            }
+
+            if (next && next->size_i == new_size_i) {
+                return;
+            }
+        }
+    }
+
+    ~ConcurrentLinearHashingHashTable() {
+        for (Table *t = current.load(std::memory_order_relaxed); t;) {
+            Table *next = t->next.load(std::memory_order_relaxed);
+            delete t;
+            t = next;
+        }
+    }
+
+private:
+    static constexpr std::size_t chunk_size = 1024;
+
+    struct Slot {
+        std::atomic<K> key{empty_key};
+        std::atomic<V> value{empty_value};
+    };
+
+    struct Table {
+        explicit Table(std::size_t size_i) :
+                size_i(size_i),
+                slots(new Slot[Capacity::size(size_i)]),
+                next(nullptr) {}
+
+        inline std::size_t size() const {
+            return Capacity::size(size_i);
+        }
+
+        inline std::size_t chunks() const {
+            return (size() + chunk_size - 1) / chunk_size;
+        }
+
+        std::size_t size_i;
+        std::unique_ptr<Slot[]> slots;
+        std::atomic<Table *> next;
+        std::atomic<std::size_t> shrinking{0};
+
+        // claimed keys and current tombstones, written by every inserting thread
+        alignas(cache_line_size) std::atomic<std::size_t> used{0};
+        std::atomic<std::size_t> removed{0};
+
+        // migration progress, claimed chunks may still be in work
+        alignas(cache_line_size) std::atomic<std::size_t> claimed_chunks{0};
+        std::atomic<std::size_t> migrated_chunks{0};
+    };
+
+    static inline bool live(V value) {
+        return value < moved;
+    }
+
+    // the slot of key in t, or the empty slot where its probe sequence ends,
+    // nullptr when t is full without the key and the search goes on in t->next
+    Slot *lookup(Table *t, const K &key) {
+        std::size_t h = Capacity::reduce(hash(key), t->size_i);
+
+        for (std::size_t probes = 0; probes < t->size(); ++probes, h = next_slot(t, h)) {
+            K slot_key = t->slots[h].key.load(std::memory_order_acquire);
+
+            if (slot_key == key || slot_key == empty_key) {
+                return &t->slots[h];
+            }
+        }
+
+        return nullptr;
+    }
+
+    // like lookup, but claims the empty slot for key unless it is already moved,
+    // nullptr once a full t has a next table to go on with. New keys wait while t is
+    // still filled by the migration of the table before it or migrated into a smaller
+    // one, so copies always fit.
+    Slot *claim(Table *t, const K &key) {
+        for (;;) {
+            std::size_t h = Capacity::reduce(hash(key), t->size_i);
+            std::size_t probes = 0;
+
+            for (; probes < t->size(); ++probes, h = next_slot(t, h)) {
+                Slot &slot = t->slots[h];
+                K slot_key = slot.key.load(std::memory_order_acquire);
+
+                if (slot_key == empty_key) {
+                    if (slot.value.load(std::memory_order_acquire) == moved) {
+                        return &slot;
+                    }
+
+                    std::size_t used = t->used.fetch_add(1, std::memory_order_seq_cst) + 1;
+
+                    if (!takes_new_keys(t)) {
+                        t->used.fetch_sub(1, std::memory_order_relaxed);
+                        break;
+                    }
+
+                    if (slot.key.compare_exchange_strong(slot_key, key, std::memory_order_acq_rel)) {
+                        if (used >= threshold(t)) {
+                            start_resize(t);
+                        }
+
+                        return &slot;
+                    }
+
+                    t->used.fetch_sub(1, std::memory_order_relaxed);
+                }
+
+                if (slot_key == key) {
+                    return &slot;
+                }
+            }
+
+            if (probes == t->size()) {
+                start_resize(t);
+
+                if (t->next.load(std::memory_order_acquire)) {
+                    return nullptr;
+                }
+
+                if (t->size_i + 1 == Capacity::count && current.load(std::memory_order_acquire) == t) {
+                    throw std::length_error("hash table capacity exhausted");
+                }
+            }
+
+            help_migrate(current.load(std::memory_order_acquire));
+            std::this_thread::yield();
+        }
+    }
+
+    // A shrink sizes the next table for the entries t has when it starts, keys claimed in t
+    // during the migration would be copied too and could fill it. A grown next table has
+    // room for t's entries up to the load factor limit and those t can still take. New keys
+    // are counted before the check, so a shrink reading the counts either sees them or is
+    // seen by them.
+    bool takes_new_keys(Table *t) {
+        if (current.load(std::memory_order_acquire) != t || t->shrinking.load(std::memory_order_seq_cst)) {
+            return false;
+        }
+
+        Table *next = t->next.load(std::memory_order_acquire);
+        return !next || next->size_i >= t->size_i;
+    }
+
+    static inline std::size_t threshold(Table *t) {
+        return static_cast<std::size_t>(static_cast<double>(t->size()) * load_factor_limit);
+    }
+
+    // mostly removed tables are rebuilt at the same size, a table at the last growth step
+    // is only ever rebuilt and fills up past the load factor limit otherwise
+    void start_resize(Table *t) {
+        std::size_t non_removed_size = t->used.load(std::memory_order_relaxed) - t->removed.load(std::memory_order_relaxed);
+
+        if (non_removed_size < threshold(t) / 2) {
+            start_resize(t, t->size_i);
+        } else if (t->size_i + 1 < Capacity::count) {
+            start_resize(t, t->size_i + 1);
+        }
+    }
+
+    // tables are resized one at a time, so a migration never copies into a table that is
+    // being migrated itself
+    void start_resize(Table *t, std::size_t new_size_i) {
+        if (t->next.load(std::memory_order_acquire) || current.load(std::memory_order_acquire) != t) {
+            return;
+        }
+
+        assert(new_size_i < Capacity::count);
+
+        reclaimer.reclaim();
+        auto *next = new Table(new_size_i);
+        Table *expected = nullptr;
+
+        if (!t->next.compare_exchange_strong(expected, next, std::memory_order_acq_rel)) {
+            delete next;
+        }
+    }
+
+    // migrates one chunk of t if it is being resized
+    void help_migrate(Table *t) {
+        Table *next = t->next.load(std::memory_order_acquire);
+
+        if (!next || t->claimed_chunks.load(std::memory_order_relaxed) >= t->chunks()) {
+            return;
+        }
+
+        std::size_t chunk = t->claimed_chunks.fetch_add(1, std::memory_order_relaxed);
+
+        if (chunk >= t->chunks()) {
+            return;
+        }
+
+        for (std::size_t i = chunk * chunk_size; i < std::min(t->size(), (chunk + 1) * chunk_size); ++i) {
+            migrate_slot(t->slots[i], next);
+        }
+
+        if (t->migrated_chunks.fetch_add(1, std::memory_order_acq_rel) + 1 < t->chunks()) {
+            return;
+        }
+
+        // the current table can only advance past tables that are fully migrated,
+        // whoever unlinks one retires it
+        Table *c = current.load(std::memory_order_acquire);
+
+        while (c->next.load(std::memory_order_acquire) &&
+               c->migrated_chunks.load(std::memory_order_acquire) == c->chunks()) {
+            if (current.compare_exchange_weak(c, c->next.load(std::memory_order_acquire), std::memory_order_acq_rel)) {
+                reclaimer.retire([c] { delete c; });
+                c = current.load(std::memory_order_acquire);
+            }
+        }
+    }
+
+    // copies the entry into next until the value it copied is the one marked moved,
+    // only the thread that claimed the chunk writes the copy before that
+    void migrate_slot(Slot &slot, Table *next) {
+        Slot *copy = nullptr;
+        V copied = empty_value;
+        V value = slot.value.load(std::memory_order_acquire);
+
+        while (value != moved) {
+            K key = slot.key.load(std::memory_order_acquire);
+
+            if (key != empty_key && (live(value) || copy)) {
+                if (!copy) {
+                    copy = copy_slot(next, key);
+                }
+
+                V copy_value = live(value) ? value : tombstone;
+                copy->value.store(copy_value, std::memory_order_release);
+
+                // next counts the tombstones copied into it like those of removes
+                if (copy_value == tombstone && copied != tombstone) {
+                    next->removed.fetch_add(1, std::memory_order_relaxed);
+                } else if (copy_value != tombstone && copied == tombstone) {
+                    next->removed.fetch_sub(1, std::memory_order_relaxed);
+                }
+
+                copied = copy_value;
+            }
+
+            if (slot.value.compare_exchange_weak(value, moved, std::memory_order_acq_rel)) {
+                return;
+            }
+        }
+    }
+
+    // next is not resized before this migration is done, so it has no moved slots
+    Slot *copy_slot(Table *next, K key) {
+        std::size_t h = Capacity::reduce(hash(key), next->size_i);
+
+        for (;; h = next_slot(next, h)) {
+            Slot &slot = next->slots[h];
+            K slot_key = slot.key.load(std::memory_order_acquire);
+
+            if (slot_key == empty_key && slot.key.compare_exchange_strong(slot_key, key, std::memory_order_acq_rel)) {
+                next->used.fetch_add(1, std::memory_order_relaxed);
+                return &slot;
+            }
+
+            if (slot_key == key) {
+                return &slot;
+            }
+        }
+    }
+
+    static inline std::size_t next_slot(Table *t, std::size_t h) {
+        return h + 1 < t->size() ? h + 1 : 0;
+    }
+
+    alignas(cache_line_size) std::atomic<Table *> current;
+    H <K> hash;
+    EpochReclaimer reclaimer;
+};
+
+#endif //UNTITLED3_CONCURRENTLINEARPROBINGHASHTABLE_H
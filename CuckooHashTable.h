@@ -0,0 +1,688 @@
+#ifndef UNTITLED3_CUCKOOHASHTABLE_H
+#define UNTITLED3_CUCKOOHASHTABLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <ranges>
+#include <span>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <cassert>
+#include "Hash.h"
+#include "CapacityPolicy.h"
+#include "Prefetch.h"
+#include "Entry.h"
+#include "Stats.h"
+#include "TableIterator.h"
+
+static constexpr double cuckoo_default_load_factor_limit = 0.9;
+
+// as many slots as fit into one cache line next to their tags, but at least 2 and at most 4;
+// entries of more than (cache_line_size - alignof(Entry)) / 2 bytes, 24 for 8 byte alignment,
+// still get 2 slots and their buckets take two cache lines
+template<typename K, typename V>
+constexpr std::size_t cuckoo_ways =
+        std::clamp<std::size_t>((cache_line_size - alignof(Entry<K, V>)) / sizeof(Entry<K, V>), 2, 4);
+
+// Bucketized cuckoo hashing: every key lives in one of two buckets of a few slots each,
+// so a lookup reads at most two buckets whatever the load factor. The first bucket is the
+// home slot of the other tables, the second one lies a step away that is derived from other
+// bits of the hash the way double hashing derives its step. A bucket is aligned to a cache
+// line and takes one as long as its slots fit (3 slots for 8 byte keys and values); with
+// larger entries a bucket takes two lines and a lookup reads up to four.
+//
+// An insert into two full buckets searches breadth first for a short chain of entries that
+// can each move to their other bucket, the last one into a free slot, and moves them from the
+// end of the chain. When there is no such chain the table grows.
+template<typename K, typename V, template<typename> typename H, double load_factor_limit = cuckoo_default_load_factor_limit,
+        typename Capacity = PrimeCapacity, typename Stats = NoStats> requires Hash<H, K>
+class CuckooHashTable {
+private:
+    static constexpr std::size_t ways = cuckoo_ways<K, V>;
+
+    // buckets searched for a free slot before an insert gives up and grows the table
+    static constexpr std::size_t max_search_buckets = 256;
+
+    // kept out of the buckets so lookups still read one line per bucket, the search for a
+    // free slot and rehash locate entries from them instead of hashing their keys
+    static constexpr bool stores_hashes = stores_hash<K>;
+
+    struct alignas(cache_line_size) Bucket {
+        // a tag is never 0, 0 marks an empty slot
+        std::uint8_t tags[ways]{};
+        Entry<K, V> slots[ways];
+    };
+
+    struct Location {
+        std::size_t first;
+        std::size_t second;
+        std::uint8_t tag;
+    };
+
+public:
+    using key_type = K;
+    using mapped_type = V;
+    using hasher = H<K>;
+    using find_result = std::optional<std::reference_wrapper<std::pair<const K, V>>>;
+    using iterator = SlotIterator<CuckooHashTable, std::pair<const K, V>>;
+    using const_iterator = SlotIterator<const CuckooHashTable, const std::pair<const K, V>>;
+    using capacity_sized = void;
+
+    // a find that records into the stats writes to the table
+    static constexpr bool mutating_find = Stats::enabled;
+
+    // an insert with no chain of moves to a free slot grows the table at any load factor
+    static constexpr bool rehashes_below_load_factor_limit = true;
+
+    explicit CuckooHashTable() : size_i(0),
+                                 non_removed_size(0),
+                                 buckets(allocate_buckets(Capacity::size(0))),
+                                 hashes(allocate_hashes(Capacity::size(0))),
+                                 hash(H < K > {}) {}
+
+    template<std::ranges::input_range R>
+    requires std::constructible_from<std::pair<const K, V>, std::ranges::range_reference_t<R>> &&
+             (!std::same_as<std::remove_cvref_t<R>, CuckooHashTable>)
+    explicit CuckooHashTable(R &&range) : CuckooHashTable() {
+        insert_range(std::forward<R>(range));
+    }
+
+    CuckooHashTable(const CuckooHashTable &) = delete;
+
+    CuckooHashTable &operator=(const CuckooHashTable &) = delete;
+
+    bool insert(std::pair<const K, V> &&kv) {
+        return emplace_key(kv.first, std::move(kv.second));
+    }
+
+    // the pair is built first to get at its key, which is then moved into the table
+    template<typename... Args>
+    bool emplace(Args &&... args) {
+        std::pair<K, V> kv(std::forward<Args>(args)...);
+        return emplace_key(std::move(kv.first), std::move(kv.second));
+    }
+
+    // the value is constructed from args in place, and only if the key is absent
+    template<typename... Args>
+    bool try_emplace(const K &key, Args &&... args) {
+        return emplace_key(key, std::forward<Args>(args)...);
+    }
+
+    template<typename... Args>
+    bool try_emplace(K &&key, Args &&... args) {
+        return emplace_key(std::move(key), std::forward<Args>(args)...);
+    }
+
+    // false when the key was present and only its value was assigned
+    template<typename M>
+    bool insert_or_assign(const K &key, M &&value) {
+        return assign_key(key, std::forward<M>(value));
+    }
+
+    template<typename M>
+    bool insert_or_assign(K &&key, M &&value) {
+        return assign_key(std::move(key), std::forward<M>(value));
+    }
+
+    // a sized range is reserved for once and inserted without per element load factor checks
+    template<std::ranges::input_range R>
+    requires std::constructible_from<std::pair<const K, V>, std::ranges::range_reference_t<R>>
+    void insert_range(R &&range) {
+        if constexpr (std::ranges::sized_range<R>) {
+            reserve(fullness() + std::ranges::size(range));
+
+            for (auto &&kv: range) {
+                std::pair<K, V> entry(std::forward<decltype(kv)>(kv));
+                emplace_without_rehash(std::move(entry.first), std::move(entry.second));
+            }
+        } else {
+            for (auto &&kv: range) {
+                emplace(std::forward<decltype(kv)>(kv));
+            }
+        }
+    }
+
+    // grows the table so that n entries fit below the load factor limit
+    void reserve(std::size_t n) {
+        std::size_t new_size_i = fitting_size_index<Capacity>((n + ways - 1) / ways, load_factor_limit);
+
+        if (new_size_i > size_i) {
+            rehash(new_size_i);
+        }
+    }
+
+    // shrinks to the smallest capacity that holds the entries below the load factor limit
+    void shrink_to_fit() {
+        std::size_t new_size_i = std::min(size_i, fitting_size_index<Capacity>((fullness() + ways - 1) / ways, load_factor_limit));
+
+        if (new_size_i < size_i) {
+            rehash(new_size_i);
+        }
+    }
+
+    // a remove that leaves the load factor below min_load_factor shrinks the table to where the
+    // entries fill half the limit; 0, the default, never shrinks. Capped at a quarter of the
+    // limit, so that neither a grow nor another shrink follows right away.
+    void set_shrink_load_factor(double min_load_factor) {
+        shrink_load_factor = std::min(min_load_factor, load_factor_limit / 4);
+    }
+
+    template<LookupKey<H, K> Q = K>
+    std::optional<std::reference_wrapper<std::pair<const K, V>>> find(const Q &key, std::size_t &probes_count) {
+        const auto &lookup_key = as_lookup_key<H, K>(key);
+        return find_from(lookup_key, locate(hash(lookup_key)), probes_count);
+    }
+
+    template<LookupKey<H, K> Q = K>
+    find_result find(const Q &key) {
+        std::size_t probes_count = 0;
+        return find(key, probes_count);
+    }
+
+    template<LookupKey<H, K> Q = K>
+    bool contains(const Q &key) {
+        std::size_t probes_count = 0;
+        return find(key, probes_count).has_value();
+    }
+
+    // hashes a group of keys and prefetches both of their buckets before probing any of
+    // them, so the cache misses of the group overlap instead of being paid one by one
+    void find_batch(std::span<const K> keys, std::vector<find_result> &results, std::size_t &probes_count) {
+        results.resize(keys.size());
+        std::array<Location, prefetch_batch_width> locations;
+
+        for (std::size_t begin = 0; begin < keys.size(); begin += prefetch_batch_width) {
+            std::size_t count = std::min(prefetch_batch_width, keys.size() - begin);
+
+            for (std::size_t j = 0; j < count; ++j) {
+                locations[j] = locate(hash(keys[begin + j]));
+                prefetch(buckets + locations[j].first);
+                prefetch(buckets + locations[j].second);
+            }
+
+            for (std::size_t j = 0; j < count; ++j) {
+                results[begin + j] = find_from(keys[begin + j], locations[j], probes_count);
+            }
+        }
+    }
+
+    void find_batch(std::span<const K> keys, std::vector<find_result> &results) {
+        std::size_t probes_count = 0;
+        find_batch(keys, results, probes_count);
+    }
+
+    template<LookupKey<H, K> Q = K>
+    std::optional<std::pair<K, V>> remove(const Q &key) {
+        const auto &lookup_key = as_lookup_key<H, K>(key);
+        std::size_t probes_count = 0;
+
+        Location location = locate(hash(lookup_key));
+        auto slot = find_slot(lookup_key, location, probes_count);
+
+        if (!slot) {
+            return {};
+        }
+
+        Bucket &bucket = buckets[slot->first];
+        std::pair<K, V> removed_kv = bucket.slots[slot->second].extract();
+
+        bucket.slots[slot->second].destroy();
+        bucket.tags[slot->second] = 0;
+        --non_removed_size;
+        shrink_if_sparse();
+
+        return {std::move(removed_kv)};
+    }
+
+    std::size_t fullness() {
+        return non_removed_size;
+    }
+
+    // in slots, not buckets
+    inline std::size_t size() const {
+        return bucket_count() * ways;
+    }
+
+    inline double load_factor() {
+        return static_cast<double>(non_removed_size) / static_cast<double>(size());
+    }
+
+    // A hit reads the second bucket only for entries stored there, those whose first bucket
+    // was full. A bucket is the first one of Poisson(alpha * ways) keys and takes others as
+    // their second one, on average half of those before a given key of its own; the share
+    // in second buckets is the fixed point of the resulting overflow.
+    double successful_probes_evaluation() {
+        double lambda = load_factor() * static_cast<double>(ways);
+
+        if (lambda == 0) {
+            return 1.;
+        }
+
+        double in_second = 0;
+
+        for (int i = 0; i < 16; ++i) {
+            double room = static_cast<double>(ways) - in_second * lambda / 2;
+
+            // E[(X - room)+] = lambda - room + E[(room - X)+]
+            double overflow = lambda - room;
+            double p = std::exp(-lambda);
+
+            for (std::size_t k = 0; static_cast<double>(k) < room; ++k) {
+                overflow += (room - static_cast<double>(k)) * p;
+                p *= lambda / static_cast<double>(k + 1);
+            }
+
+            in_second = overflow / lambda;
+        }
+
+        return 1. + in_second;
+    }
+
+    // a miss always reads both buckets
+    double failed_probes_evaluation() {
+        return 2.;
+    }
+
+    // lookup and rehash counters stay zero unless the table collects stats
+    TableStats stats() {
+        TableStats result = stats_policy.snapshot();
+        result.allocated_bytes = bucket_count() * (sizeof(Bucket) + (stores_hashes ? ways * sizeof(std::size_t) : 0));
+
+        return result;
+    }
+
+    // entries bucket by bucket, slots without a tag are skipped
+    iterator begin() {
+        return {this, 0, size()};
+    }
+
+    iterator end() {
+        return {this, size(), size()};
+    }
+
+    const_iterator begin() const {
+        return {this, 0, size()};
+    }
+
+    const_iterator end() const {
+        return {this, size(), size()};
+    }
+
+    // fn(kv) for every entry, the buckets split over threads
+    template<typename F>
+    void parallel_for_each(F fn, std::size_t threads = std::thread::hardware_concurrency()) {
+        parallel_for_each_position<iterator>(this, size(), fn, threads);
+    }
+
+    void debug() {
+        for (std::size_t b = 0; b < bucket_count(); ++b) {
+            for (std::size_t s = 0; s < ways; ++s) {
+                if (buckets[b].tags[s]) {
+                    std::cout << buckets[b].slots[s].kv.first << " " << buckets[b].slots[s].kv.second << "\n";
+                }
+            }
+        }
+        std::cout << std::endl;
+    }
+
+    ~CuckooHashTable() {
+        destroy_buckets(buckets, bucket_count());
+        delete[] hashes;
+    }
+
+private:
+    inline std::size_t bucket_count() const {
+        return Capacity::size(size_i);
+    }
+
+    template<typename, typename> friend class SlotIterator;
+
+    // position b * ways + s is slot s of bucket b
+    inline std::size_t next_full(std::size_t i, std::size_t end) const {
+        while (i < end && !buckets[i / ways].tags[i % ways]) {
+            ++i;
+        }
+
+        return i;
+    }
+
+    inline std::pair<const K, V> &position_kv(std::size_t i) {
+        return buckets[i / ways].slots[i % ways].kv;
+    }
+
+    inline const std::pair<const K, V> &position_kv(std::size_t i) const {
+        return buckets[i / ways].slots[i % ways].kv;
+    }
+
+    // the second bucket is a step away from the first, the step and the tag come from the
+    // high bits of the mixed hash, so keys sharing their first bucket are spread over others
+    inline Location locate(std::size_t h) {
+        std::size_t mixed = h * 0x9E3779B97F4A7C15ull;
+        std::size_t first = Capacity::reduce(h, size_i);
+        std::size_t step = Capacity::step(Capacity::reduce(mixed >> 32, size_i), size_i);
+
+        std::size_t second = first + step < bucket_count() ? first + step : first + step - bucket_count();
+        auto tag = static_cast<std::uint8_t>((mixed >> 57) + 1);
+
+        return {first, second, tag};
+    }
+
+    template<typename Q>
+    find_result find_from(const Q &key, const Location &location, std::size_t &probes_count) {
+        std::size_t first_probe = probes_count;
+        auto slot = find_slot(key, location, probes_count);
+
+        stats_policy.record_lookup(slot.has_value(), probes_count - first_probe);
+
+        if (slot) {
+            return {std::ref(buckets[slot->first].slots[slot->second].kv)};
+        }
+
+        return {};
+    }
+
+    // bucket and slot of the key, a probe is a bucket
+    template<typename Q>
+    std::optional<std::pair<std::size_t, std::size_t>> find_slot(const Q &key, const Location &location,
+                                                                 std::size_t &probes_count) {
+        for (std::size_t b: {location.first, location.second}) {
+            ++probes_count;
+
+            for (std::size_t s = 0; s < ways; ++s) {
+                if (buckets[b].tags[s] == location.tag && buckets[b].slots[s].kv.first == key) {
+                    return {{b, s}};
+                }
+            }
+        }
+
+        return {};
+    }
+
+    static Bucket *allocate_buckets(std::size_t count) {
+        Bucket *result = std::allocator<Bucket>{}.allocate(count);
+
+        for (std::size_t b = 0; b < count; ++b) {
+            std::construct_at(result + b);
+        }
+
+        return result;
+    }
+
+    // one per slot, slot s of bucket b at b * ways + s
+    static std::size_t *allocate_hashes(std::size_t count) {
+        return stores_hashes ? new std::size_t[count * ways] : nullptr;
+    }
+
+    inline std::size_t key_hash(const Bucket *buckets, const std::size_t *hashes, std::size_t b, std::size_t s) {
+        if constexpr (stores_hashes) {
+            return hashes[b * ways + s];
+        } else {
+            return hash(buckets[b].slots[s].kv.first);
+        }
+    }
+
+    static void destroy_buckets(Bucket *buckets, std::size_t count) {
+        for (std::size_t b = 0; b < count; ++b) {
+            for (std::size_t s = 0; s < ways; ++s) {
+                if (buckets[b].tags[s]) {
+                    buckets[b].slots[s].destroy();
+                }
+            }
+        }
+
+        std::allocator<Bucket>{}.deallocate(buckets, count);
+    }
+
+    // after a remove, see set_shrink_load_factor
+    void shrink_if_sparse() {
+        if (load_factor() < shrink_load_factor) {
+            std::size_t new_size_i = fitting_size_index<Capacity>((2 * fullness() + ways - 1) / ways,
+                                                                  load_factor_limit);
+
+            if (new_size_i < size_i) {
+                rehash(new_size_i);
+            }
+        }
+    }
+
+    // Entries leave the old array as they are placed in the new one. When one does not fit,
+    // the placed ones are put back into free slots of the old array and the rebuild starts
+    // over at the next size, so every entry is moved into the final array once.
+    void rehash(std::size_t new_size_i) {
+        typename Stats::RehashTimer timer(stats_policy);
+
+        std::size_t old_size_i = size_i;
+        std::size_t old_count = bucket_count();
+        Bucket *old_buckets = buckets;
+        std::size_t *old_hashes = hashes;
+
+        for (;;) {
+            size_i = new_size_i;
+            buckets = allocate_buckets(bucket_count());
+            hashes = allocate_hashes(bucket_count());
+
+            if (place_all(old_buckets, old_hashes, old_count)) {
+                break;
+            }
+
+            put_back(old_buckets, old_hashes);
+            destroy_buckets(buckets, bucket_count());
+            delete[] hashes;
+
+            size_i = old_size_i;
+            buckets = old_buckets;
+            hashes = old_hashes;
+            new_size_i = next_size_index<Capacity>(new_size_i);
+        }
+
+        destroy_buckets(old_buckets, old_count);
+        delete[] old_hashes;
+    }
+
+    // false when an entry finds no slot, it and those after it are left where they are
+    bool place_all(Bucket *from, const std::size_t *from_hashes, std::size_t count) {
+        for (std::size_t b = 0; b < count; ++b) {
+            for (std::size_t s = 0; s < ways; ++s) {
+                if (!from[b].tags[s]) {
+                    continue;
+                }
+
+                // extract only names the pair, place moves from it once it has a slot
+                std::pair<K, V> &&kv = from[b].slots[s].extract();
+
+                if (!place<K, V>(key_hash(from, from_hashes, b, s), kv.first, kv.second)) {
+                    return false;
+                }
+
+                from[b].slots[s].destroy();
+                from[b].tags[s] = 0;
+            }
+        }
+
+        return true;
+    }
+
+    // moves the entries of the current array into the free slots of to, in any order
+    void put_back(Bucket *to, std::size_t *to_hashes) {
+        std::size_t free = 0;
+
+        for (std::size_t b = 0; b < bucket_count(); ++b) {
+            for (std::size_t s = 0; s < ways; ++s) {
+                if (!buckets[b].tags[s]) {
+                    continue;
+                }
+
+                while (to[free / ways].tags[free % ways]) {
+                    ++free;
+                }
+
+                Bucket &bucket = to[free / ways];
+                bucket.slots[free % ways].construct(buckets[b].slots[s].extract());
+                bucket.tags[free % ways] = buckets[b].tags[s];
+
+                if constexpr (stores_hashes) {
+                    to_hashes[free] = hashes[b * ways + s];
+                }
+
+                buckets[b].slots[s].destroy();
+                buckets[b].tags[s] = 0;
+            }
+        }
+    }
+
+    template<typename KK, typename... Args>
+    bool emplace_key(KK &&key, Args &&... args) {
+        if (load_factor() >= load_factor_limit) {
+            rehash(next_size_index<Capacity>(size_i));
+        }
+
+        return emplace_without_rehash(std::forward<KK>(key), std::forward<Args>(args)...);
+    }
+
+    template<typename KK, typename M>
+    bool assign_key(KK &&key, M &&value) {
+        std::size_t probes_count = 0;
+
+        if (auto kv = find(key, probes_count)) {
+            kv->get().second = std::forward<M>(value);
+            return false;
+        }
+
+        return emplace_key(std::forward<KK>(key), std::forward<M>(value));
+    }
+
+    // grows even below the load factor limit when no slot can be freed for the key
+    template<typename KK, typename... Args>
+    bool emplace_without_rehash(KK &&key, Args &&... args) {
+        std::size_t probes_count = 0;
+
+        std::size_t new_hash = hash(key);
+
+        if (find_slot(key, locate(new_hash), probes_count)) {
+            return false;
+        }
+
+        while (!place<KK, Args...>(new_hash, key, args...)) {
+            rehash(next_size_index<Capacity>(size_i));
+        }
+
+        ++non_removed_size;
+        return true;
+    }
+
+    // constructs the entry in a free slot of one of its buckets, emptying one by moving a
+    // chain of entries if needed; the arguments are only forwarded once it succeeds, with
+    // the value categories given as the template arguments
+    template<typename KK, typename... Args>
+    bool place(std::size_t new_hash, KK &key, Args &... args) {
+        Location location = locate(new_hash);
+        auto slot = free_slot(location);
+
+        if (!slot) {
+            return false;
+        }
+
+        Bucket &bucket = buckets[slot->first];
+
+        bucket.slots[slot->second].construct(std::piecewise_construct,
+                                             std::forward_as_tuple(std::forward<KK>(key)),
+                                             std::forward_as_tuple(std::forward<Args>(args)...));
+        bucket.tags[slot->second] = location.tag;
+
+        if constexpr (stores_hashes) {
+            hashes[slot->first * ways + slot->second] = new_hash;
+        }
+
+        return true;
+    }
+
+    // one bucket of the breadth first search, reached by moving the entry in slot of the
+    // parent bucket here
+    struct SearchNode {
+        std::size_t bucket;
+        std::size_t parent;
+        std::size_t slot;
+    };
+
+    std::optional<std::pair<std::size_t, std::size_t>> free_slot(const Location &location) {
+        static constexpr std::size_t root = ~std::size_t{0};
+
+        std::array<SearchNode, max_search_buckets> nodes;
+        std::size_t nodes_count = 2;
+
+        nodes[0] = {location.first, root, 0};
+        nodes[1] = {location.second, root, 0};
+
+        for (std::size_t i = 0; i < nodes_count; ++i) {
+            Bucket &bucket = buckets[nodes[i].bucket];
+
+            for (std::size_t s = 0; s < ways; ++s) {
+                if (!bucket.tags[s]) {
+                    return move_chain(nodes, i, s);
+                }
+            }
+
+            for (std::size_t s = 0; s < ways && nodes_count < max_search_buckets; ++s) {
+                Location entry = locate(key_hash(buckets, hashes, nodes[i].bucket, s));
+                std::size_t other = entry.first == nodes[i].bucket ? entry.second : entry.first;
+
+                // a chain visits a bucket once, otherwise a move could take an entry that
+                // an earlier move of the same chain has put there
+                bool on_chain = false;
+
+                for (std::size_t j = i; j != root; j = nodes[j].parent) {
+                    on_chain |= nodes[j].bucket == other;
+                }
+
+                if (!on_chain) {
+                    nodes[nodes_count++] = {other, i, s};
+                }
+            }
+        }
+
+        return {};
+    }
+
+    // moves the entries of the chain ending in node i towards the free slot, returns the
+    // slot freed in the first bucket of the chain
+    std::pair<std::size_t, std::size_t> move_chain(const std::array<SearchNode, max_search_buckets> &nodes,
+                                                   std::size_t i, std::size_t free) {
+        for (; nodes[i].parent != ~std::size_t{0}; i = nodes[i].parent) {
+            Bucket &from = buckets[nodes[nodes[i].parent].bucket];
+            Bucket &to = buckets[nodes[i].bucket];
+            std::size_t s = nodes[i].slot;
+
+            to.slots[free].construct(from.slots[s].extract());
+            to.tags[free] = from.tags[s];
+
+            if constexpr (stores_hashes) {
+                hashes[nodes[i].bucket * ways + free] = hashes[nodes[nodes[i].parent].bucket * ways + s];
+            }
+
+            from.slots[s].destroy();
+            from.tags[s] = 0;
+
+            free = s;
+        }
+
+        return {nodes[i].bucket, free};
+    }
+
+    std::size_t size_i;
+    std::size_t non_removed_size;
+
+    Bucket *buckets;
+    std::size_t *hashes;
+    H <K> hash;
+    double shrink_load_factor = 0;
+    [[no_unique_address]] Stats stats_policy;
+};
+
+#endif //UNTITLED3_CUCKOOHASHTABLE_H
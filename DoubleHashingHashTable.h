@@ -2,95 +2,294 @@
 #define UNTITLED3_DOUBLEHASHINGHASHTABLE_H
 
 #include <cstddef>
+#include <atomic>
+#include <filesystem>
 #include <memory>
 #include <optional>
+#include <ranges>
+#include <span>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include <array>
+#include <algorithm>
 #include <cassert>
 #include <complex>
 #include "Hash.h"
-#include "PrimeNumbers.h"
+#include "CapacityPolicy.h"
+#include "SlotStorage.h"
+#include "Prefetch.h"
+#include "Stats.h"
+#include "Snapshot.h"
+#include "TableIterator.h"
+#include "RehashExecutor.h"
 
 static constexpr double default_load_factor_limit = 0.8;
 
-template<typename K, typename V, template<typename> typename H, double load_factor_limit = default_load_factor_limit> requires Hash<H, K>
+template<typename K, typename V, template<typename> typename H, double load_factor_limit = default_load_factor_limit,
+        template<typename, typename, typename> typename Storage = NodeSlotStorage,
+        typename Capacity = PrimeCapacity,
+        typename Allocator = std::allocator<std::pair<const K, V>>,
+        typename Stats = NoStats> requires Hash<H, K>
 class DoubleHashingHashTable {
-private:
-    struct Node {
-        explicit Node(std::pair<const K, V> kv) : kv(kv), isRemoved(false) {}
+public:
+    using key_type = K;
+    using mapped_type = V;
+    using hasher = H<K>;
+    using find_result = std::optional<std::reference_wrapper<std::pair<const K, V>>>;
+    using iterator = SlotIterator<DoubleHashingHashTable, std::pair<const K, V>>;
+    using const_iterator = SlotIterator<const DoubleHashingHashTable, const std::pair<const K, V>>;
+    using capacity_sized = void;
+
+    // a find that records into the stats writes to the table
+    static constexpr bool mutating_find = Stats::enabled;
+
+    // tombstones count against the load factor limit, an insert can rebuild the table before
+    // it holds that many entries
+    static constexpr bool rehashes_below_load_factor_limit = true;
+
+    explicit DoubleHashingHashTable(const Allocator &allocator = Allocator()) :
+            size_i(0),
+            non_empty_size(0),
+            non_removed_size(0),
+            allocator(allocator),
+            slots(Capacity::size(0), allocator),
+            hash(H < K > {}) {}
+
+    template<std::ranges::input_range R>
+    requires std::constructible_from<std::pair<const K, V>, std::ranges::range_reference_t<R>> &&
+             (!std::same_as<std::remove_cvref_t<R>, DoubleHashingHashTable>)
+    explicit DoubleHashingHashTable(R &&range, const Allocator &allocator = Allocator()) :
+            DoubleHashingHashTable(allocator) {
+        insert_range(std::forward<R>(range));
+    }
+
+    bool insert(std::pair<const K, V> &&kv) {
+        return emplace_key(kv.first, std::move(kv.second));
+    }
+
+    // the pair is built first to get at its key, which is then moved into the table
+    template<typename... Args>
+    bool emplace(Args &&... args) {
+        std::pair<K, V> kv(std::forward<Args>(args)...);
+        return emplace_key(std::move(kv.first), std::move(kv.second));
+    }
+
+    // the value is constructed from args in place, and only if the key is absent
+    template<typename... Args>
+    bool try_emplace(const K &key, Args &&... args) {
+        return emplace_key(key, std::forward<Args>(args)...);
+    }
+
+    template<typename... Args>
+    bool try_emplace(K &&key, Args &&... args) {
+        return emplace_key(std::move(key), std::forward<Args>(args)...);
+    }
+
+    // false when the key was present and only its value was assigned
+    template<typename M>
+    bool insert_or_assign(const K &key, M &&value) {
+        return assign_key(key, std::forward<M>(value));
+    }
+
+    template<typename M>
+    bool insert_or_assign(K &&key, M &&value) {
+        return assign_key(std::move(key), std::forward<M>(value));
+    }
 
-        std::pair<const K, V> kv;
-        bool isRemoved;
+    // a sized range is reserved for once and inserted without per element load factor checks
+    template<std::ranges::input_range R>
+    requires std::constructible_from<std::pair<const K, V>, std::ranges::range_reference_t<R>>
+    void insert_range(R &&range) {
+        if constexpr (std::ranges::sized_range<R>) {
+            reserve(fullness() + std::ranges::size(range));
 
-        const K &key() {
-            return kv.first;
+            for (auto &&kv: range) {
+                std::pair<K, V> entry(std::forward<decltype(kv)>(kv));
+                emplace_without_rehash(std::move(entry.first), std::move(entry.second));
+            }
+        } else {
+            for (auto &&kv: range) {
+                emplace(std::forward<decltype(kv)>(kv));
+            }
         }
+    }
 
-        V &value() {
-            return kv.second;
+    // grows the table so that n entries fit below the load factor limit, tombstones are
+    // cleaned up if they would push the occupancy over it
+    void reserve(std::size_t n) {
+        std::size_t new_size_i = std::max(size_i, fitting_size_index<Capacity>(n, load_factor_limit));
+        std::size_t new_entries = n > non_removed_size ? n - non_removed_size : 0;
+
+        if (new_size_i > size_i || static_cast<double>(non_empty_size + new_entries) >=
+                                   load_factor_limit * static_cast<double>(size())) {
+            rehash(new_size_i);
         }
-    };
+    }
 
-public:
-    explicit DoubleHashingHashTable() : size_i(0),
-                                        non_nullptr_size(0),
-                                        non_removed_size(0),
-                                        nodes(new Node *[prime_numbers[0]]),
-                                        hash(H < K > {}) {
-        std::fill(nodes, nodes + prime_numbers[0], nullptr);
+    // shrinks to the smallest capacity that holds the entries below the load factor limit,
+    // tombstones are dropped even when the capacity stays
+    void shrink_to_fit() {
+        std::size_t new_size_i = std::min(size_i, fitting_size_index<Capacity>(fullness(), load_factor_limit));
+
+        if (new_size_i < size_i || non_empty_size > non_removed_size) {
+            rehash(new_size_i);
+        }
     }
 
-    bool insert(std::pair<const K, V> &&kv) {
-        if (load_factor() >= load_factor_limit) {
-            rehash();
+    // a remove that leaves the load factor below min_load_factor shrinks the table to where the
+    // entries fill half the limit; 0, the default, never shrinks. Capped at a quarter of the
+    // limit, so that neither a grow nor another shrink follows right away.
+    void set_shrink_load_factor(double min_load_factor) {
+        shrink_load_factor = std::min(min_load_factor, load_factor_limit / 4);
+    }
+
+    template<LookupKey<H, K> Q = K>
+    std::optional<std::reference_wrapper<std::pair<const K, V>>> find(const Q &key, std::size_t &probes_count) {
+        const auto &lookup_key = as_lookup_key<H, K>(key);
+        std::size_t key_hash = hash(lookup_key);
+        return find_from(lookup_key, key_hash, Capacity::reduce(key_hash, size_i), probes_count);
+    }
+
+    template<LookupKey<H, K> Q = K>
+    find_result find(const Q &key) {
+        std::size_t probes_count = 0;
+        return find(key, probes_count);
+    }
+
+    template<LookupKey<H, K> Q = K>
+    bool contains(const Q &key) {
+        std::size_t probes_count = 0;
+        return find(key, probes_count).has_value();
+    }
+
+    // hashes a group of keys and prefetches their slots before probing any of them, so
+    // the cache misses of the group overlap instead of being paid one after another
+    void find_batch(std::span<const K> keys, std::vector<find_result> &results, std::size_t &probes_count) {
+        results.resize(keys.size());
+        std::array<std::size_t, prefetch_batch_width> key_hashes;
+        std::array<std::size_t, prefetch_batch_width> homes;
+
+        for (std::size_t begin = 0; begin < keys.size(); begin += prefetch_batch_width) {
+            std::size_t count = std::min(prefetch_batch_width, keys.size() - begin);
+
+            for (std::size_t j = 0; j < count; ++j) {
+                key_hashes[j] = hash(keys[begin + j]);
+                homes[j] = Capacity::reduce(key_hashes[j], size_i);
+                slots.prefetch_slot(homes[j]);
+            }
+
+            for (std::size_t j = 0; j < count; ++j) {
+                slots.prefetch_entry(homes[j]);
+            }
+
+            for (std::size_t j = 0; j < count; ++j) {
+                results[begin + j] = find_from(keys[begin + j], key_hashes[j], homes[j], probes_count);
+            }
         }
+    }
 
-        return insert_without_rehash(std::move(kv));
+    void find_batch(std::span<const K> keys, std::vector<find_result> &results) {
+        std::size_t probes_count = 0;
+        find_batch(keys, results, probes_count);
     }
 
-    std::optional<std::reference_wrapper<std::pair<const K, V>>> find(const K &key, std::size_t &probes_count) {
-        std::size_t h1 = hash(key) % size();
-        std::size_t h2 = 1 + (h1 % (size() - 1));
+    template<LookupKey<H, K> Q = K>
+    std::optional<std::pair<K, V>> remove(const Q &key) {
+        const auto &lookup_key = as_lookup_key<H, K>(key);
+        std::size_t key_hash = hash(lookup_key);
+        std::size_t h1 = Capacity::reduce(key_hash, size_i);
+        std::size_t h2 = Capacity::step(h1, size_i);
 
         std::size_t h = h1;
 
-        for (std::size_t i = 0; i < size(); ++i, h = (h1 + i * h2) % size(), ++probes_count) {
-            auto node = nodes[h];
-
-            if (!node) {
-                ++probes_count;
+        for (std::size_t i = 0; i < size(); i++, h = next_slot(h, h2)) {
+            if (slots.empty(h)) {
                 return {};
             }
 
-            if (!node->isRemoved && node->key() == key) {
-                ++probes_count;
-                return {std::ref(node->kv)};
+            if (slots.full(h) && slots.matches(h, key_hash, lookup_key)) {
+                std::pair<K, V> kv = slots.remove(h);
+                --non_removed_size;
+                shrink_if_sparse();
+
+                return {std::move(kv)};
             }
         }
 
         return {};
     }
 
-    std::optional<std::pair<K, V>> remove(const K &key) {
-        std::size_t h1 = hash(key) % size();
-        std::size_t h2 = 1 + (h1 % (size() - 1));
+    // see Snapshot.h, false if the file cannot be written
+    bool save(const std::filesystem::path &path) requires SnapshotStorage<Storage<K, V, Allocator>> {
+        SnapshotHeader header = snapshot_header(size_i);
+        header.counters = {non_removed_size, non_empty_size};
 
-        std::size_t h = h1 % size();
+        return save_snapshot(path, header, slots.snapshot_sections());
+    }
 
-        for (std::size_t i = 0; i < size(); i++, h = (h1 + i * h2) % size()) {
-            auto node = nodes[h];
+    // maps a snapshot saved by a table of the same type and probes its pages in place until
+    // the next rehash; false, with the table unchanged, if the file does not fit the table
+    bool load(const std::filesystem::path &path, bool verify_checksum = true)
+    requires SnapshotStorage<Storage<K, V, Allocator>> {
+        auto snapshot = load_snapshot(path, verify_checksum);
 
-            if (node && !node->isRemoved && node->key() == key) {
-                node->isRemoved = true;
-                return {std::move(node->kv)};
-            }
+        if (!snapshot || snapshot->header.size_i >= Capacity::count ||
+            !snapshot->header.matches(snapshot_header(snapshot->header.size_i))) {
+            return false;
         }
 
-        return {};
+        size_i = snapshot->header.size_i;
+        non_removed_size = snapshot->header.counters[0];
+        non_empty_size = snapshot->header.counters[1];
+
+        Storage<K, V, Allocator> mapped(size(), std::move(snapshot->file), std::span(snapshot->sections).template first<3>(), allocator);
+        slots.swap(mapped);
+
+        return true;
+    }
+
+    // rehashes of at least parallel_rehash_min_size slots are split over the executor
+    void set_rehash_executor(RehashExecutor executor) {
+        rehash_executor = std::move(executor);
+    }
+
+    // lookup and rehash counters stay zero unless the table collects stats
+    TableStats stats() {
+        TableStats result = stats_policy.snapshot();
+        result.tombstones = non_empty_size - non_removed_size;
+        result.allocated_bytes = slots.allocated_bytes(non_empty_size);
+
+        return result;
+    }
+
+    // entries in slot order, empty and removed slots are skipped
+    iterator begin() {
+        return {this, 0, size()};
+    }
+
+    iterator end() {
+        return {this, size(), size()};
+    }
+
+    const_iterator begin() const {
+        return {this, 0, size()};
+    }
+
+    const_iterator end() const {
+        return {this, size(), size()};
+    }
+
+    // fn(kv) for every entry, the slot array split over threads
+    template<typename F>
+    void parallel_for_each(F fn, std::size_t threads = std::thread::hardware_concurrency()) {
+        parallel_for_each_position<iterator>(this, size(), fn, threads);
     }
 
     void debug() {
         for (int i = 0; i < size(); i++) {
-            if (nodes[i] && !nodes[i]->isRemoved) {
-                std::cout << nodes[i]->key() << " " << nodes[i]->value() << "\n";
+            if (slots.full(i)) {
+                std::cout << slots.kv(i).first << " " << slots.kv(i).second << "\n";
             }
         }
         std::cout << std::endl;
@@ -110,91 +309,217 @@ public:
         return non_removed_size;
     }
 
-    inline std::size_t size() {
-        return prime_numbers[size_i];
+    inline std::size_t size() const {
+        return Capacity::size(size_i);
     }
 
     inline double load_factor() {
         return static_cast<double>(non_removed_size) / static_cast<double>(size());
     }
 
-    ~DoubleHashingHashTable() {
-        for (int i = 0; i < size(); i++) {
-            delete nodes[i];
+    // share of slots that are full or removed, misses scan until an empty slot
+    inline double occupancy() {
+        return static_cast<double>(non_empty_size) / static_cast<double>(size());
+    }
+
+private:
+    template<typename, typename> friend class SlotIterator;
+
+    inline std::size_t next_full(std::size_t i, std::size_t end) const {
+        return slots.next_full(i, end);
+    }
+
+    inline std::pair<const K, V> &position_kv(std::size_t i) {
+        return slots.kv(i);
+    }
+
+    inline const std::pair<const K, V> &position_kv(std::size_t i) const {
+        return slots.kv(i);
+    }
+
+    template<typename Q>
+    find_result find_from(const Q &key, std::size_t key_hash, std::size_t h1, std::size_t &probes_count) {
+        std::size_t first_probe = probes_count;
+        find_result result = probe_from(key, key_hash, h1, probes_count);
+
+        stats_policy.record_lookup(result.has_value(), probes_count - first_probe);
+        return result;
+    }
+
+    template<typename Q>
+    find_result probe_from(const Q &key, std::size_t key_hash, std::size_t h1, std::size_t &probes_count) {
+        std::size_t h2 = Capacity::step(h1, size_i);
+
+        std::size_t h = h1;
+
+        for (std::size_t i = 0; i < size(); ++i, h = next_slot(h, h2), ++probes_count) {
+            if (slots.empty(h)) {
+                ++probes_count;
+                return {};
+            }
+
+            if (slots.full(h) && slots.matches(h, key_hash, key)) {
+                ++probes_count;
+                return {std::ref(slots.kv(h))};
+            }
         }
 
-        delete[] nodes;
+        return {};
     }
 
-private:
-    void rehash() {
+    SnapshotHeader snapshot_header(std::size_t i) {
+        auto bytes = Storage<K, V, Allocator>::snapshot_bytes(Capacity::size(i));
+        return make_snapshot_header<K, Entry<K, V>, Capacity>(SnapshotEngine::double_hashing, i, hash, bytes);
+    }
+
+    // after a remove, see set_shrink_load_factor
+    void shrink_if_sparse() {
+        if (load_factor() < shrink_load_factor) {
+            std::size_t new_size_i = fitting_size_index<Capacity>(2 * fullness(), load_factor_limit);
+
+            if (new_size_i < size_i) {
+                rehash(new_size_i);
+            }
+        }
+    }
+
+    void rehash(std::size_t new_size_i) {
+        typename Stats::RehashTimer timer(stats_policy);
         std::size_t old_size = size();
-        size_i++;
-        non_removed_size = 0;
-        non_nullptr_size = 0;
+        size_i = new_size_i;
 
-        Node **buff = new Node *[size()];
+        Storage<K, V, Allocator> buff(size(), allocator);
+        slots.swap(buff);
 
-        std::fill(buff, buff + size(), nullptr);
-        std::swap(nodes, buff);
+        if (rehash_executor && old_size >= parallel_rehash_min_size) {
+            std::atomic<std::size_t> moved = 0;
 
-        for (int i = 0; i < old_size; i++) {
-            auto node = buff[i];
+            parallel_ranges(rehash_executor, old_size, [&](std::size_t begin, std::size_t end) {
+                moved.fetch_add(move_range<true>(buff, begin, end), std::memory_order_relaxed);
+            });
 
-            if (node && !node->isRemoved) {
-                insert_without_rehash(std::move(node->kv));
+            non_removed_size = moved.load(std::memory_order_relaxed);
+        } else {
+            non_removed_size = move_range<false>(buff, 0, old_size);
+        }
+
+        non_empty_size = non_removed_size;
+    }
+
+    // moves the full slots of [begin, end) of the old storage to the first empty slot of their
+    // probe sequences, claimed atomically while other ranges are moved at once
+    template<bool concurrent>
+    std::size_t move_range(Storage<K, V, Allocator> &old, std::size_t begin, std::size_t end) {
+        std::size_t moved = 0;
+
+        for (std::size_t i = begin; i < end; i++) {
+            if (old.full(i)) {
+                std::size_t h1 = Capacity::reduce(old.key_hash(i, hash), size_i);
+                std::size_t h2 = Capacity::step(h1, size_i);
+                std::size_t h = h1;
+
+                if constexpr (concurrent) {
+                    while (!slots.try_transfer(h, old, i)) {
+                        h = next_slot(h, h2);
+                    }
+                } else {
+                    while (!slots.empty(h)) {
+                        h = next_slot(h, h2);
+                    }
+
+                    slots.transfer(h, old, i);
+                }
+
+                ++moved;
             }
+        }
 
-            delete node;
+        return moved;
+    }
+
+    template<typename KK, typename... Args>
+    bool emplace_key(KK &&key, Args &&... args) {
+        if (occupancy() >= load_factor_limit) {
+            // mostly tombstones: clean up in place instead of growing
+            rehash(load_factor() < load_factor_limit / 2 ? size_i : next_size_index<Capacity>(size_i));
         }
 
-        delete[] buff;
+        return emplace_without_rehash(std::forward<KK>(key), std::forward<Args>(args)...);
     }
 
-    bool insert_without_rehash(std::pair<const K, V> &&kv) {
-        std::size_t h1 = hash(kv.first) % size();
-        std::size_t h2 = 1 + (h1 % (size() - 1));
+    template<typename KK, typename M>
+    bool assign_key(KK &&key, M &&value) {
+        std::size_t probes_count = 0;
 
-        std::size_t h = h1 % size();
+        if (auto kv = find(key, probes_count)) {
+            kv->get().second = std::forward<M>(value);
+            return false;
+        }
 
-        for (std::size_t i = 0; i < size(); i++, h = (h1 + i * h2) % size()) {
-            auto node = nodes[h];
+        return emplace_key(std::forward<KK>(key), std::forward<M>(value));
+    }
 
-            if (node && !node->isRemoved && node->key() == kv.first) {
-                return false;
-            }
+    template<typename KK, typename... Args>
+    bool emplace_without_rehash(KK &&key, Args &&... args) {
+        std::size_t key_hash = hash(key);
+        std::size_t h1 = Capacity::reduce(key_hash, size_i);
+        std::size_t h2 = Capacity::step(h1, size_i);
 
-            if (!node) {
-                nodes[h] = new Node(std::move(kv));
+        std::size_t h = h1;
 
-                ++non_removed_size;
-                ++non_nullptr_size;
-                return true;
-            }
+        std::optional<std::size_t> removed_slot;
 
-            if (node->isRemoved) {
-                delete node;
-                nodes[h] = new Node(std::move(kv));
+        for (std::size_t i = 0; i < size(); i++, h = next_slot(h, h2)) {
+            if (slots.empty(h)) {
+                if (!removed_slot) {
+                    ++non_empty_size;
+                }
 
+                slots.emplace(removed_slot.value_or(h), key_hash, std::piecewise_construct, std::forward_as_tuple(std::forward<KK>(key)),
+                              std::forward_as_tuple(std::forward<Args>(args)...));
                 ++non_removed_size;
                 return true;
             }
+
+            // the key may still follow the tombstone, reuse the first one only once it is known to be absent
+            if (slots.removed(h)) {
+                if (!removed_slot) {
+                    removed_slot = h;
+                }
+            } else if (slots.matches(h, key_hash, key)) {
+                return false;
+            }
+        }
+
+        if (removed_slot) {
+            slots.emplace(*removed_slot, key_hash, std::piecewise_construct, std::forward_as_tuple(std::forward<KK>(key)),
+                          std::forward_as_tuple(std::forward<Args>(args)...));
+            ++non_removed_size;
+            return true;
         }
 
         assert(true);
         return false;
     }
 
+    inline std::size_t next_slot(std::size_t h, std::size_t h2) {
+        return h + h2 < size() ? h + h2 : h + h2 - size();
+    }
+
     inline std::size_t next_size() {
-        return prime_numbers[size_i + 1];
+        return Capacity::size(next_size_index<Capacity>(size_i));
     }
 
     std::size_t size_i;
-    std::size_t non_nullptr_size;
+    std::size_t non_empty_size;
     std::size_t non_removed_size;
 
-    Node **nodes;
+    Allocator allocator;
+    Storage<K, V, Allocator> slots;
     H <K> hash;
+    RehashExecutor rehash_executor;
+    double shrink_load_factor = 0;
+    [[no_unique_address]] Stats stats_policy;
 };
 
 #endif // UNTITLED3_DOUBLEHASHINGHASHTABLE_H
\ No newline at end of file
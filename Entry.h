@@ -0,0 +1,39 @@
+#ifndef UNTITLED3_ENTRY_H
+#define UNTITLED3_ENTRY_H
+
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Storage for one key/value pair. Users only ever see it as std::pair<const K, V>, the
+// tables take it apart as std::pair<K, V> so that moving an entry to another slot, node
+// or out of the table moves the key instead of copying it (the layout trick node based
+// maps use for extraction). The pair is constructed and destroyed explicitly.
+template<typename K, typename V>
+union Entry {
+    Entry() {}
+
+    ~Entry() requires std::is_trivially_destructible_v<std::pair<K, V>> = default;
+
+    ~Entry() {}
+
+    template<typename... Args>
+    void construct(Args &&... args) {
+        std::construct_at(&kv, std::forward<Args>(args)...);
+    }
+
+    void destroy() {
+        std::destroy_at(&kv);
+    }
+
+    // the moved from pair still has to be destroyed
+    std::pair<K, V> &&extract() {
+        return std::move(*std::launder(&mutable_kv));
+    }
+
+    std::pair<const K, V> kv;
+    std::pair<K, V> mutable_kv;
+};
+
+#endif //UNTITLED3_ENTRY_H
@@ -0,0 +1,216 @@
+#ifndef UNTITLED3_EPOCHRECLAIMER_H
+#define UNTITLED3_EPOCHRECLAIMER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include <cassert>
+#include "Prefetch.h"
+
+static constexpr std::size_t max_thread_slots = 256;
+
+// Small ids for the running threads, an id is reused once its thread exits. A thread past
+// max_thread_slots running ones gets std::length_error.
+class ThreadSlots {
+public:
+    static std::size_t current() {
+        thread_local Slot slot;
+        return slot.id;
+    }
+
+private:
+    struct Slot {
+        Slot() : id(acquire()) {}
+
+        ~Slot() {
+            release(id);
+        }
+
+        std::size_t id;
+    };
+
+    static std::size_t acquire() {
+        std::lock_guard lock(mutex());
+
+        if (free_ids().empty()) {
+            if (next_id() == max_thread_slots) {
+                throw std::length_error("more than max_thread_slots threads");
+            }
+
+            return next_id()++;
+        }
+
+        std::size_t id = free_ids().back();
+        free_ids().pop_back();
+
+        return id;
+    }
+
+    static void release(std::size_t id) {
+        std::lock_guard lock(mutex());
+        free_ids().push_back(id);
+    }
+
+    static std::mutex &mutex() {
+        static std::mutex instance;
+        return instance;
+    }
+
+    static std::vector<std::size_t> &free_ids() {
+        static std::vector<std::size_t> instance;
+        return instance;
+    }
+
+    static std::size_t &next_id() {
+        static std::size_t instance = 0;
+        return instance;
+    }
+};
+
+// Epoch based reclamation. A thread pins the current epoch while it may hold pointers
+// into shared memory; memory that has been unlinked is retired together with the epoch
+// it was unlinked in and freed once no thread is pinned at that epoch or an earlier one.
+// Pinning is a store to the thread's own cache line, retiring takes a lock.
+class EpochReclaimer {
+private:
+    static constexpr std::uint64_t unpinned = std::numeric_limits<std::uint64_t>::max();
+
+    struct alignas(cache_line_size) Slot {
+        std::atomic<std::uint64_t> epoch{unpinned};
+    };
+
+public:
+    class Guard {
+    public:
+        explicit Guard(EpochReclaimer &reclaimer) : slot(reclaimer.slots[ThreadSlots::current()]) {
+            assert(slot.epoch.load(std::memory_order_relaxed) == unpinned);
+            // a later epoch than a retire comes with what was unlinked before it
+            slot.epoch.store(reclaimer.epoch.load(std::memory_order_acquire), std::memory_order_relaxed);
+
+            // either the reclaimer sees the pin or this thread sees the memory unlinked
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+
+        Guard(const Guard &) = delete;
+
+        Guard &operator=(const Guard &) = delete;
+
+        ~Guard() {
+            slot.epoch.store(unpinned, std::memory_order_release);
+        }
+
+    private:
+        Slot &slot;
+    };
+
+    EpochReclaimer() = default;
+
+    EpochReclaimer(const EpochReclaimer &) = delete;
+
+    EpochReclaimer &operator=(const EpochReclaimer &) = delete;
+
+    Guard pin() {
+        return Guard(*this);
+    }
+
+    // deleter runs once every thread pinned before this call has unpinned
+    void retire(std::function<void()> deleter) {
+        std::lock_guard lock(retired_mutex);
+
+        retired.emplace_back(epoch.fetch_add(1, std::memory_order_acq_rel), std::move(deleter));
+
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        collect();
+    }
+
+    // frees what can be freed now, retire does it on its own
+    void reclaim() {
+        std::lock_guard lock(retired_mutex);
+        collect();
+    }
+
+    ~EpochReclaimer() {
+        for (auto &[retire_epoch, deleter]: retired) {
+            deleter();
+        }
+    }
+
+private:
+    void collect() {
+        std::uint64_t oldest = unpinned;
+
+        for (Slot &slot: slots) {
+            oldest = std::min(oldest, slot.epoch.load(std::memory_order_acquire));
+        }
+
+        std::erase_if(retired, [oldest](auto &entry) {
+            if (entry.first >= oldest) {
+                return false;
+            }
+
+            entry.second();
+            return true;
+        });
+    }
+
+    std::array<Slot, max_thread_slots> slots;
+    alignas(cache_line_size) std::atomic<std::uint64_t> epoch{0};
+
+    std::mutex retired_mutex;
+    std::vector<std::pair<std::uint64_t, std::function<void()>>> retired;
+};
+
+// Standard allocator that retires what a table frees to an EpochReclaimer instead of freeing
+// it, readers pinned meanwhile may still be looking at it. Copies and rebound copies share
+// the reclaimer; detach() makes all of them free right away again, for a table no reader
+// can reach any more. Default constructed, it frees right away.
+template<typename T>
+class EpochAllocator {
+public:
+    using value_type = T;
+
+    EpochAllocator() : reclaimer(std::make_shared<EpochReclaimer *>(nullptr)) {}
+
+    explicit EpochAllocator(EpochReclaimer &reclaimer) : reclaimer(std::make_shared<EpochReclaimer *>(&reclaimer)) {}
+
+    template<typename U>
+    EpochAllocator(const EpochAllocator<U> &other) noexcept : reclaimer(other.reclaimer) {}
+
+    T *allocate(std::size_t n) {
+        return std::allocator<T>{}.allocate(n);
+    }
+
+    void deallocate(T *p, std::size_t n) noexcept {
+        if (EpochReclaimer *target = *reclaimer) {
+            target->retire([p, n] { std::allocator<T>{}.deallocate(p, n); });
+        } else {
+            std::allocator<T>{}.deallocate(p, n);
+        }
+    }
+
+    void detach() {
+        *reclaimer = nullptr;
+    }
+
+    template<typename U>
+    bool operator==(const EpochAllocator<U> &other) const noexcept {
+        return reclaimer == other.reclaimer;
+    }
+
+private:
+    template<typename U>
+    friend class EpochAllocator;
+
+    std::shared_ptr<EpochReclaimer *> reclaimer;
+};
+
+#endif //UNTITLED3_EPOCHRECLAIMER_H
@@ -0,0 +1,630 @@
+#ifndef UNTITLED3_GROUPPROBINGHASHTABLE_H
+#define UNTITLED3_GROUPPROBINGHASHTABLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <ranges>
+#include <span>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <iostream>
+#include <cassert>
+#include <bit>
+#include <cstring>
+#include <cmath>
+#include "Hash.h"
+#include "CapacityPolicy.h"
+#include "Prefetch.h"
+#include "Stats.h"
+#include "Entry.h"
+#include "TableIterator.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+static constexpr double group_default_load_factor_limit = 0.875;
+
+// 16 control bytes probed at once. A control byte is either one of the negative
+// markers below or the 7 bit tag of a full slot's hash.
+struct ControlGroup {
+    static constexpr std::size_t width = 16;
+
+    static constexpr std::int8_t empty = -128;
+    static constexpr std::int8_t removed = -2;
+
+#if defined(__SSE2__)
+    explicit ControlGroup(const std::int8_t *ctrl) : ctrl(_mm_loadu_si128(reinterpret_cast<const __m128i *>(ctrl))) {}
+
+    inline std::uint32_t match(std::int8_t h2) const {
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(h2)));
+    }
+
+    inline std::uint32_t match_empty() const {
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(empty)));
+    }
+
+    // empty and removed are the only negative control bytes
+    inline std::uint32_t match_empty_or_removed() const {
+        return _mm_movemask_epi8(ctrl);
+    }
+
+    __m128i ctrl;
+#else
+    explicit ControlGroup(const std::int8_t *ctrl) {
+        std::memcpy(this->ctrl, ctrl, width);
+    }
+
+    inline std::uint32_t match(std::int8_t h2) const {
+        std::uint32_t mask = 0;
+
+        for (std::size_t i = 0; i < width; ++i) {
+            mask |= static_cast<std::uint32_t>(ctrl[i] == h2) << i;
+        }
+
+        return mask;
+    }
+
+    inline std::uint32_t match_empty() const {
+        return match(empty);
+    }
+
+    inline std::uint32_t match_empty_or_removed() const {
+        std::uint32_t mask = 0;
+
+        for (std::size_t i = 0; i < width; ++i) {
+            mask |= static_cast<std::uint32_t>(ctrl[i] < 0) << i;
+        }
+
+        return mask;
+    }
+
+    std::int8_t ctrl[width];
+#endif
+};
+
+// Swiss table style open addressing: a probe loads the 16 control bytes starting at
+// the home slot and compares them with the 7 bit tag of the key at once, keys are
+// compared only for matching tags. The first width - 1 control bytes are cloned past
+// the end so that a group starting near the end wraps around without a branch.
+template<typename K, typename V, template<typename> typename H, double load_factor_limit = group_default_load_factor_limit,
+        typename Capacity = PrimeCapacity, typename Stats = NoStats> requires Hash<H, K>
+class GroupProbingHashTable {
+private:
+    using Slot = Entry<K, V>;
+
+    // tags already keep most key comparisons away, stored hashes spare rehash from hashing
+    static constexpr bool stores_hashes = stores_hash<K>;
+
+public:
+    using key_type = K;
+    using mapped_type = V;
+    using hasher = H<K>;
+    using find_result = std::optional<std::reference_wrapper<std::pair<const K, V>>>;
+    using iterator = SlotIterator<GroupProbingHashTable, std::pair<const K, V>>;
+    using const_iterator = SlotIterator<const GroupProbingHashTable, const std::pair<const K, V>>;
+    using capacity_sized = void;
+
+    // a find that records into the stats writes to the table
+    static constexpr bool mutating_find = Stats::enabled;
+
+    // tombstones count against the load factor limit, an insert can rebuild the table before
+    // it holds that many entries
+    static constexpr bool rehashes_below_load_factor_limit = true;
+
+    explicit GroupProbingHashTable() : size_i(0),
+                                       non_empty_size(0),
+                                       non_removed_size(0),
+                                       ctrl(new std::int8_t[Capacity::size(0) + ControlGroup::width - 1]),
+                                       slots(std::allocator<Slot>{}.allocate(Capacity::size(0))),
+                                       hashes(allocate_hashes(Capacity::size(0))),
+                                       hash(H < K > {}) {
+        std::fill(ctrl, ctrl + Capacity::size(0) + ControlGroup::width - 1, ControlGroup::empty);
+    }
+
+    template<std::ranges::input_range R>
+    requires std::constructible_from<std::pair<const K, V>, std::ranges::range_reference_t<R>> &&
+             (!std::same_as<std::remove_cvref_t<R>, GroupProbingHashTable>)
+    explicit GroupProbingHashTable(R &&range) : GroupProbingHashTable() {
+        insert_range(std::forward<R>(range));
+    }
+
+    GroupProbingHashTable(const GroupProbingHashTable &) = delete;
+
+    GroupProbingHashTable &operator=(const GroupProbingHashTable &) = delete;
+
+    bool insert(std::pair<const K, V> &&kv) {
+        return emplace_key(kv.first, std::move(kv.second));
+    }
+
+    // the pair is built first to get at its key, which is then moved into the table
+    template<typename... Args>
+    bool emplace(Args &&... args) {
+        std::pair<K, V> kv(std::forward<Args>(args)...);
+        return emplace_key(std::move(kv.first), std::move(kv.second));
+    }
+
+    // the value is constructed from args in place, and only if the key is absent
+    template<typename... Args>
+    bool try_emplace(const K &key, Args &&... args) {
+        return emplace_key(key, std::forward<Args>(args)...);
+    }
+
+    template<typename... Args>
+    bool try_emplace(K &&key, Args &&... args) {
+        return emplace_key(std::move(key), std::forward<Args>(args)...);
+    }
+
+    // false when the key was present and only its value was assigned
+    template<typename M>
+    bool insert_or_assign(const K &key, M &&value) {
+        return assign_key(key, std::forward<M>(value));
+    }
+
+    template<typename M>
+    bool insert_or_assign(K &&key, M &&value) {
+        return assign_key(std::move(key), std::forward<M>(value));
+    }
+
+    // a sized range is reserved for once and inserted without per element load factor checks
+    template<std::ranges::input_range R>
+    requires std::constructible_from<std::pair<const K, V>, std::ranges::range_reference_t<R>>
+    void insert_range(R &&range) {
+        if constexpr (std::ranges::sized_range<R>) {
+            reserve(fullness() + std::ranges::size(range));
+
+            for (auto &&kv: range) {
+                std::pair<K, V> entry(std::forward<decltype(kv)>(kv));
+                emplace_without_rehash(std::move(entry.first), std::move(entry.second));
+            }
+        } else {
+            for (auto &&kv: range) {
+                emplace(std::forward<decltype(kv)>(kv));
+            }
+        }
+    }
+
+    // grows the table so that n entries fit below the load factor limit, tombstones are
+    // cleaned up if they would push the occupancy over it
+    void reserve(std::size_t n) {
+        std::size_t new_size_i = std::max(size_i, fitting_size_index<Capacity>(n, load_factor_limit));
+        std::size_t new_entries = n > non_removed_size ? n - non_removed_size : 0;
+
+        if (new_size_i > size_i || static_cast<double>(non_empty_size + new_entries) >=
+                                   load_factor_limit * static_cast<double>(size())) {
+            rehash(new_size_i);
+        }
+    }
+
+    // shrinks to the smallest capacity that holds the entries below the load factor limit,
+    // tombstones are dropped even when the capacity stays
+    void shrink_to_fit() {
+        std::size_t new_size_i = std::min(size_i, fitting_size_index<Capacity>(fullness(), load_factor_limit));
+
+        if (new_size_i < size_i || non_empty_size > non_removed_size) {
+            rehash(new_size_i);
+        }
+    }
+
+    // a remove that leaves the load factor below min_load_factor shrinks the table to where the
+    // entries fill half the limit; 0, the default, never shrinks. Capped at a quarter of the
+    // limit, so that neither a grow nor another shrink follows right away.
+    void set_shrink_load_factor(double min_load_factor) {
+        shrink_load_factor = std::min(min_load_factor, load_factor_limit / 4);
+    }
+
+    template<LookupKey<H, K> Q = K>
+    std::optional<std::reference_wrapper<std::pair<const K, V>>> find(const Q &key, std::size_t &probes_count) {
+        const auto &lookup_key = as_lookup_key<H, K>(key);
+        return find_from(lookup_key, mix(hash(lookup_key)), probes_count);
+    }
+
+    template<LookupKey<H, K> Q = K>
+    find_result find(const Q &key) {
+        std::size_t probes_count = 0;
+        return find(key, probes_count);
+    }
+
+    template<LookupKey<H, K> Q = K>
+    bool contains(const Q &key) {
+        std::size_t probes_count = 0;
+        return find(key, probes_count).has_value();
+    }
+
+    // hashes a group of keys and prefetches their control bytes and slots before probing
+    // any of them, so the cache misses of the group overlap instead of being paid one by one
+    void find_batch(std::span<const K> keys, std::vector<find_result> &results, std::size_t &probes_count) {
+        results.resize(keys.size());
+        std::array<std::size_t, prefetch_batch_width> mixed_hashes;
+
+        for (std::size_t begin = 0; begin < keys.size(); begin += prefetch_batch_width) {
+            std::size_t count = std::min(prefetch_batch_width, keys.size() - begin);
+
+            for (std::size_t j = 0; j < count; ++j) {
+                mixed_hashes[j] = mix(hash(keys[begin + j]));
+
+                std::size_t pos = Capacity::reduce(mixed_hashes[j], size_i);
+                prefetch(ctrl + pos);
+                prefetch(slots + pos);
+            }
+
+            for (std::size_t j = 0; j < count; ++j) {
+                results[begin + j] = find_from(keys[begin + j], mixed_hashes[j], probes_count);
+            }
+        }
+    }
+
+    void find_batch(std::span<const K> keys, std::vector<find_result> &results) {
+        std::size_t probes_count = 0;
+        find_batch(keys, results, probes_count);
+    }
+
+    template<LookupKey<H, K> Q = K>
+    std::optional<std::pair<K, V>> remove(const Q &key) {
+        const auto &lookup_key = as_lookup_key<H, K>(key);
+        std::size_t probes_count = 0;
+        auto slot = find_slot_from(lookup_key, mix(hash(lookup_key)), probes_count);
+
+        if (!slot) {
+            return {};
+        }
+
+        std::size_t i = *slot;
+        std::pair<K, V> removed_kv = slots[i].extract();
+
+        slots[i].destroy();
+        set_ctrl(i, ControlGroup::removed);
+        --non_removed_size;
+        shrink_if_sparse();
+
+        return {std::move(removed_kv)};
+    }
+
+    std::size_t fullness() {
+        return non_removed_size;
+    }
+
+    inline std::size_t size() const {
+        return Capacity::size(size_i);
+    }
+
+    // uniform hashing over groups: a miss stops at the first group with an empty slot
+    double failed_probes_evaluation() {
+        return groups_to_empty(static_cast<double>(non_empty_size) / static_cast<double>(size()));
+    }
+
+    double successful_probes_evaluation() {
+        auto alpha = static_cast<double>(fullness()) / static_cast<double>(size());
+
+        if (alpha == 0) {
+            return 1.;
+        }
+
+        // average of the failed search cost over the insertion history, (1 / a) * integral_0^a
+        constexpr std::size_t steps = 100;
+        double sum = 0;
+
+        for (std::size_t i = 0; i < steps; ++i) {
+            sum += groups_to_empty(alpha * (static_cast<double>(i) + 0.5) / steps);
+        }
+
+        return sum / steps;
+    }
+
+    inline double load_factor() {
+        return static_cast<double>(non_removed_size) / static_cast<double>(size());
+    }
+
+    // lookup and rehash counters stay zero unless the table collects stats
+    TableStats stats() {
+        TableStats result = stats_policy.snapshot();
+        result.tombstones = non_empty_size - non_removed_size;
+        result.allocated_bytes = size() * (sizeof(Slot) + (stores_hashes ? sizeof(std::size_t) : 0)) +
+                                 size() + ControlGroup::width - 1;
+
+        return result;
+    }
+
+    // entries in slot order, a group of control bytes is skipped at once
+    iterator begin() {
+        return {this, 0, size()};
+    }
+
+    iterator end() {
+        return {this, size(), size()};
+    }
+
+    const_iterator begin() const {
+        return {this, 0, size()};
+    }
+
+    const_iterator end() const {
+        return {this, size(), size()};
+    }
+
+    // fn(kv) for every entry, the slot array split over threads
+    template<typename F>
+    void parallel_for_each(F fn, std::size_t threads = std::thread::hardware_concurrency()) {
+        parallel_for_each_position<iterator>(this, size(), fn, threads);
+    }
+
+    void debug() {
+        for (std::size_t i = 0; i < size(); i++) {
+            if (ctrl[i] >= 0) {
+                std::cout << slots[i].kv.first << " " << slots[i].kv.second << "\n";
+            }
+        }
+        std::cout << std::endl;
+    }
+
+    ~GroupProbingHashTable() {
+        destroy_slots(ctrl, slots, hashes, size());
+    }
+
+private:
+    template<typename, typename> friend class SlotIterator;
+
+    // the cloned control bytes past size() keep the last group load in bounds
+    inline std::size_t next_full(std::size_t i, std::size_t end) const {
+        for (; i < end; i += ControlGroup::width) {
+            std::uint32_t full = ~ControlGroup(ctrl + i).match_empty_or_removed() & ((1u << ControlGroup::width) - 1);
+
+            if (end - i < ControlGroup::width) {
+                full &= (1u << (end - i)) - 1;
+            }
+
+            if (full) {
+                return i + std::countr_zero(full);
+            }
+        }
+
+        return end;
+    }
+
+    inline std::pair<const K, V> &position_kv(std::size_t i) {
+        return slots[i].kv;
+    }
+
+    inline const std::pair<const K, V> &position_kv(std::size_t i) const {
+        return slots[i].kv;
+    }
+
+    template<typename Q>
+    find_result find_from(const Q &key, std::size_t mixed, std::size_t &probes_count) {
+        std::size_t first_probe = probes_count;
+        auto slot = find_slot_from(key, mixed, probes_count);
+
+        stats_policy.record_lookup(slot.has_value(), probes_count - first_probe);
+
+        if (slot) {
+            return {std::ref(slots[*slot].kv)};
+        }
+
+        return {};
+    }
+
+    template<typename Q>
+    std::optional<std::size_t> find_slot_from(const Q &key, std::size_t mixed, std::size_t &probes_count) {
+        std::int8_t h2 = tag(mixed);
+        std::size_t pos = Capacity::reduce(mixed, size_i);
+
+        for (std::size_t probed = 0; probed < size(); probed += ControlGroup::width) {
+            ++probes_count;
+            ControlGroup group(ctrl + pos);
+
+            for (std::uint32_t mask = group.match(h2); mask; mask &= mask - 1) {
+                std::size_t i = slot_index(pos, std::countr_zero(mask));
+
+                if (slots[i].kv.first == key) {
+                    return {i};
+                }
+            }
+
+            if (group.match_empty()) {
+                return {};
+            }
+
+            pos = next_group(pos);
+        }
+
+        return {};
+    }
+
+    // the tag takes the high bits, the low bits are folded in for PowerOfTwoCapacity
+    static inline std::size_t mix(std::size_t h) {
+        h *= 0x9E3779B97F4A7C15ull;
+        return h ^ (h >> 32);
+    }
+
+    static inline std::int8_t tag(std::size_t mixed) {
+        return static_cast<std::int8_t>(mixed >> 57);
+    }
+
+    static inline double groups_to_empty(double alpha) {
+        return 1. / (1. - std::pow(alpha, ControlGroup::width));
+    }
+
+    inline std::size_t slot_index(std::size_t pos, std::size_t offset) {
+        std::size_t i = pos + offset;
+        return i < size() ? i : i - size();
+    }
+
+    inline std::size_t next_group(std::size_t pos) {
+        pos += ControlGroup::width;
+        return pos < size() ? pos : pos - size();
+    }
+
+    inline void set_ctrl(std::size_t i, std::int8_t value) {
+        ctrl[i] = value;
+
+        if (i < ControlGroup::width - 1) {
+            ctrl[size() + i] = value;
+        }
+    }
+
+    static std::size_t *allocate_hashes(std::size_t size) {
+        return stores_hashes ? new std::size_t[size] : nullptr;
+    }
+
+    inline std::size_t key_hash(const std::size_t *hashes, const Slot *slots, std::size_t i) {
+        if constexpr (stores_hashes) {
+            return hashes[i];
+        } else {
+            return hash(slots[i].kv.first);
+        }
+    }
+
+    static void destroy_slots(std::int8_t *ctrl, Slot *slots, std::size_t *hashes, std::size_t size) {
+        for (std::size_t i = 0; i < size; ++i) {
+            if (ctrl[i] >= 0) {
+                slots[i].destroy();
+            }
+        }
+
+        std::allocator<Slot>{}.deallocate(slots, size);
+        delete[] ctrl;
+        delete[] hashes;
+    }
+
+    // after a remove, see set_shrink_load_factor
+    void shrink_if_sparse() {
+        if (load_factor() < shrink_load_factor) {
+            std::size_t new_size_i = fitting_size_index<Capacity>(2 * fullness(), load_factor_limit);
+
+            if (new_size_i < size_i) {
+                rehash(new_size_i);
+            }
+        }
+    }
+
+    void rehash(std::size_t new_size_i) {
+        typename Stats::RehashTimer timer(stats_policy);
+        std::size_t old_size = size();
+        size_i = new_size_i;
+        non_removed_size = 0;
+        non_empty_size = 0;
+
+        std::int8_t *old_ctrl = ctrl;
+        Slot *old_slots = slots;
+        std::size_t *old_hashes = hashes;
+
+        ctrl = new std::int8_t[size() + ControlGroup::width - 1];
+        slots = std::allocator<Slot>{}.allocate(size());
+        hashes = allocate_hashes(size());
+        std::fill(ctrl, ctrl + size() + ControlGroup::width - 1, ControlGroup::empty);
+
+        for (std::size_t i = 0; i < old_size; i++) {
+            if (old_ctrl[i] >= 0) {
+                // keys are unique and there are no tombstones yet, the first empty slot will do
+                std::size_t old_hash = key_hash(old_hashes, old_slots, i);
+                std::size_t mixed = mix(old_hash);
+                std::size_t pos = Capacity::reduce(mixed, size_i);
+                std::uint32_t available;
+
+                while (!(available = ControlGroup(ctrl + pos).match_empty())) {
+                    pos = next_group(pos);
+                }
+
+                std::size_t target = slot_index(pos, std::countr_zero(available));
+
+                slots[target].construct(old_slots[i].extract());
+                set_ctrl(target, tag(mixed));
+
+                if constexpr (stores_hashes) {
+                    hashes[target] = old_hash;
+                }
+                ++non_empty_size;
+                ++non_removed_size;
+            }
+        }
+
+        destroy_slots(old_ctrl, old_slots, old_hashes, old_size);
+    }
+
+    template<typename KK, typename... Args>
+    bool emplace_key(KK &&key, Args &&... args) {
+        if (static_cast<double>(non_empty_size) / static_cast<double>(size()) >= load_factor_limit) {
+            // mostly tombstones: clean up in place instead of growing
+            rehash(load_factor() < load_factor_limit / 2 ? size_i : next_size_index<Capacity>(size_i));
+        }
+
+        return emplace_without_rehash(std::forward<KK>(key), std::forward<Args>(args)...);
+    }
+
+    template<typename KK, typename M>
+    bool assign_key(KK &&key, M &&value) {
+        std::size_t probes_count = 0;
+
+        if (auto kv = find(key, probes_count)) {
+            kv->get().second = std::forward<M>(value);
+            return false;
+        }
+
+        return emplace_key(std::forward<KK>(key), std::forward<M>(value));
+    }
+
+    template<typename KK, typename... Args>
+    bool emplace_without_rehash(KK &&key, Args &&... args) {
+        std::size_t new_hash = hash(key);
+        std::size_t mixed = mix(new_hash);
+        std::int8_t h2 = tag(mixed);
+        std::size_t pos = Capacity::reduce(mixed, size_i);
+
+        std::optional<std::size_t> target;
+
+        for (std::size_t probed = 0; probed < size(); probed += ControlGroup::width) {
+            ControlGroup group(ctrl + pos);
+
+            for (std::uint32_t mask = group.match(h2); mask; mask &= mask - 1) {
+                if (slots[slot_index(pos, std::countr_zero(mask))].kv.first == key) {
+                    return false;
+                }
+            }
+
+            if (std::uint32_t available = group.match_empty_or_removed(); available && !target) {
+                target = slot_index(pos, std::countr_zero(available));
+            }
+
+            if (group.match_empty()) {
+                break;
+            }
+
+            pos = next_group(pos);
+        }
+
+        assert(target);
+
+        if (ctrl[*target] == ControlGroup::empty) {
+            ++non_empty_size;
+        }
+
+        slots[*target].construct(std::piecewise_construct, std::forward_as_tuple(std::forward<KK>(key)),
+                                 std::forward_as_tuple(std::forward<Args>(args)...));
+        set_ctrl(*target, h2);
+        ++non_removed_size;
+
+        if constexpr (stores_hashes) {
+            hashes[*target] = new_hash;
+        }
+
+        return true;
+    }
+
+    std::size_t size_i;
+    std::size_t non_empty_size;
+    std::size_t non_removed_size;
+
+    std::int8_t *ctrl;
+    Slot *slots;
+    std::size_t *hashes;
+    H <K> hash;
+    double shrink_load_factor = 0;
+    [[no_unique_address]] Stats stats_policy;
+};
+
+#endif //UNTITLED3_GROUPPROBINGHASHTABLE_H
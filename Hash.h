@@ -1,7 +1,9 @@
 #ifndef UNTITLED3_HASH_H
 #define UNTITLED3_HASH_H
 
+#include <cstddef>
 #include <concepts>
+#include <type_traits>
 
 template<template<typename> typename H, typename K>
 concept Hash = requires(H<K> h, const K &k) {
@@ -9,4 +11,65 @@ concept Hash = requires(H<K> h, const K &k) {
     { h(k) } -> std::convertible_to<std::size_t>;
 };
 
+// Hashers opt in to lookups by other key types with an is_transparent member, Q then has
+// to hash like the K it equals
+template<template<typename> typename H, typename K, typename Q>
+concept TransparentHash = Hash<H, K> && requires(H<K> h, const Q &q, const K &k) {
+    typename H<K>::is_transparent;
+    { h(q) } -> std::convertible_to<std::size_t>;
+    { k == q } -> std::convertible_to<bool>;
+};
+
+// a key the tables can be searched by: used as it is with a transparent hasher,
+// converted to K otherwise
+template<typename Q, template<typename> typename H, typename K>
+concept LookupKey = TransparentHash<H, K, Q> || std::convertible_to<const Q &, K>;
+
+template<template<typename> typename H, typename K, typename Q>
+decltype(auto) as_lookup_key(const Q &key) {
+    if constexpr (std::same_as<Q, K> || TransparentHash<H, K, Q>) {
+        return (key);
+    } else {
+        return K(key);
+    }
+}
+
+// The tables keep the hash of every entry next to it when stores_hash is set: probes compare
+// hashes before keys and growing never hashes a key again. Trivially copyable keys are
+// taken to be cheap to hash and compare, specialize for keys or hashers that are not.
+template<typename K>
+constexpr bool stores_hash = !std::is_trivially_copyable_v<K>;
+
+// the hash a node keeps, empty when hashes are not stored: get hashes the key again and
+// matches leaves the decision to the key comparison
+template<bool stored>
+struct StoredHash {
+    explicit StoredHash(std::size_t) {}
+
+    template<typename Q, typename Hasher>
+    inline std::size_t get(const Q &key, Hasher &hash) const {
+        return hash(key);
+    }
+
+    inline bool matches(std::size_t) const {
+        return true;
+    }
+};
+
+template<>
+struct StoredHash<true> {
+    explicit StoredHash(std::size_t value) : value(value) {}
+
+    template<typename Q, typename Hasher>
+    inline std::size_t get(const Q &, Hasher &) const {
+        return value;
+    }
+
+    inline bool matches(std::size_t key_hash) const {
+        return value == key_hash;
+    }
+
+    std::size_t value;
+};
+
 #endif //UNTITLED3_HASH_H
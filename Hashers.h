@@ -0,0 +1,170 @@
+#ifndef UNTITLED3_HASHERS_H
+#define UNTITLED3_HASHERS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <bit>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+// Hashers for the tables: every bit of the result depends on every bit of the key, so the
+// low bits PowerOfTwoCapacity masks and the slots linear probing walks are spread as well as
+// the high bits. std::hash of an integer is the identity on libstdc++ and libc++.
+
+// the splitmix64 finalizer, a bijection
+inline constexpr std::uint64_t mix64(std::uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9ull;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBull;
+    x ^= x >> 31;
+    return x;
+}
+
+// a and b replaced by the low and high halves of their 128-bit product
+inline void multiply_128(std::uint64_t &a, std::uint64_t &b) {
+#if defined(__SIZEOF_INT128__)
+    unsigned __int128 product = static_cast<unsigned __int128>(a) * b;
+    a = static_cast<std::uint64_t>(product);
+    b = static_cast<std::uint64_t>(product >> 64);
+#else
+    std::uint64_t a_low = a & 0xFFFFFFFFull, a_high = a >> 32;
+    std::uint64_t b_low = b & 0xFFFFFFFFull, b_high = b >> 32;
+    std::uint64_t low_low = a_low * b_low, low_high = a_low * b_high;
+    std::uint64_t high_low = a_high * b_low, high_high = a_high * b_high;
+    std::uint64_t middle = (low_low >> 32) + (low_high & 0xFFFFFFFFull) + (high_low & 0xFFFFFFFFull);
+    a = (middle << 32) | (low_low & 0xFFFFFFFFull);
+    b = high_high + (low_high >> 32) + (high_low >> 32) + (middle >> 32);
+#endif
+}
+
+// the halves of the 128-bit product, xored
+inline std::uint64_t multiply_fold(std::uint64_t a, std::uint64_t b) {
+    multiply_128(a, b);
+    return a ^ b;
+}
+
+namespace hashers_detail {
+    inline constexpr std::uint64_t secret[4] = {
+            0x2D358DCCAA6C78A5ull, 0x8BB84B93962EACC9ull, 0x4B33A62ED433D4A3ull, 0x4D5A2DA51DE1AA47ull
+    };
+
+    inline std::uint64_t read8(const unsigned char *p) {
+        std::uint64_t value;
+        std::memcpy(&value, p, sizeof(value));
+        return std::endian::native == std::endian::little ? value : std::byteswap(value);
+    }
+
+    inline std::uint64_t read4(const unsigned char *p) {
+        std::uint32_t value;
+        std::memcpy(&value, p, sizeof(value));
+        return std::endian::native == std::endian::little ? value : std::byteswap(value);
+    }
+}
+
+// wyhash (final version): 16 bytes per multiplication, three independent lanes above 48
+// bytes, keys up to 16 bytes are read with at most four overlapping loads and no loop
+inline std::uint64_t hash_bytes(const void *data, std::size_t length, std::uint64_t seed = 0) {
+    using namespace hashers_detail;
+
+    auto p = static_cast<const unsigned char *>(data);
+    std::uint64_t a, b;
+
+    seed ^= multiply_fold(seed ^ secret[0], secret[1]);
+
+    if (length <= 16) {
+        if (length >= 4) {
+            std::size_t shift = (length >> 3) << 2;
+            a = (read4(p) << 32) | read4(p + shift);
+            b = (read4(p + length - 4) << 32) | read4(p + length - 4 - shift);
+        } else if (length > 0) {
+            a = (std::uint64_t{p[0]} << 16) | (std::uint64_t{p[length >> 1]} << 8) | p[length - 1];
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        std::size_t i = length;
+
+        if (i > 48) {
+            std::uint64_t seed1 = seed, seed2 = seed;
+
+            do {
+                seed = multiply_fold(read8(p) ^ secret[1], read8(p + 8) ^ seed);
+                seed1 = multiply_fold(read8(p + 16) ^ secret[2], read8(p + 24) ^ seed1);
+                seed2 = multiply_fold(read8(p + 32) ^ secret[3], read8(p + 40) ^ seed2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+
+            seed ^= seed1 ^ seed2;
+        }
+
+        while (i > 16) {
+            seed = multiply_fold(read8(p) ^ secret[1], read8(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+
+        a = read8(p + i - 16);
+        b = read8(p + i - 8);
+    }
+
+    a ^= secret[1];
+    b ^= seed;
+
+    multiply_128(a, b);
+
+    return multiply_fold(a ^ secret[0] ^ length, b ^ secret[1]);
+}
+
+// mixes h into seed, unlike seed ^ h << 1 neither the order nor equal halves cancel out
+inline constexpr std::uint64_t hash_combine(std::uint64_t seed, std::uint64_t h) {
+    return mix64(seed ^ (h + 0x9E3779B97F4A7C15ull + (seed << 6) + (seed >> 2)));
+}
+
+// FastHasher<K> for integers, enums, pointers, strings and pairs of those
+template<typename K>
+struct FastHasher;
+
+template<typename K> requires std::is_integral_v<K> || std::is_enum_v<K> || std::is_pointer_v<K>
+struct FastHasher<K> {
+    std::size_t operator()(const K &key) const {
+        if constexpr (std::is_pointer_v<K>) {
+            return mix64(reinterpret_cast<std::uintptr_t>(key));
+        } else if constexpr (std::is_enum_v<K>) {
+            return mix64(static_cast<std::uint64_t>(static_cast<std::underlying_type_t<K>>(key)));
+        } else {
+            return mix64(static_cast<std::uint64_t>(key));
+        }
+    }
+};
+
+// transparent, std::string keys are found by views and literals too
+template<>
+struct FastHasher<std::string> {
+    using is_transparent = void;
+
+    std::size_t operator()(std::string_view key) const {
+        return hash_bytes(key.data(), key.size());
+    }
+};
+
+template<>
+struct FastHasher<std::string_view> {
+    std::size_t operator()(std::string_view key) const {
+        return hash_bytes(key.data(), key.size());
+    }
+};
+
+template<typename First, typename Second>
+struct FastHasher<std::pair<First, Second>> {
+    std::size_t operator()(const std::pair<First, Second> &key) const {
+        return hash_combine(FastHasher<First>{}(key.first), FastHasher<Second>{}(key.second));
+    }
+};
+
+#endif //UNTITLED3_HASHERS_H
@@ -0,0 +1,182 @@
+#ifndef UNTITLED3_HUGEPAGEALLOCATOR_H
+#define UNTITLED3_HUGEPAGEALLOCATOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <array>
+#include <new>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Where the pages of a large array go on a machine with several NUMA nodes: to the node of
+// the thread that touches them first (the kernel's default), or round robin over all nodes
+// the process may use, so random probes from every node see the same average latency.
+enum class NumaPlacement {
+    first_touch, interleave
+};
+
+namespace huge_pages_detail {
+    // of x86-64 and arm64 with 4 KiB base pages
+    inline constexpr std::size_t huge_page_size = std::size_t{2} << 20;
+
+    inline std::size_t round_up(std::size_t bytes) {
+        return (bytes + huge_page_size - 1) & ~(huge_page_size - 1);
+    }
+
+    // mbind(MPOL_INTERLEAVE) over the allowed nodes, nothing on one node or without the syscalls
+    inline void interleave(void *p, std::size_t bytes) {
+#if defined(__linux__) && defined(SYS_mbind) && defined(SYS_get_mempolicy)
+        constexpr int mpol_interleave = 3;
+        constexpr unsigned long mpol_f_mems_allowed = 1 << 2;
+        constexpr std::size_t max_nodes = 1024;
+
+        std::array<unsigned long, max_nodes / (8 * sizeof(unsigned long))> nodes{};
+
+        if (::syscall(SYS_get_mempolicy, nullptr, nodes.data(), max_nodes, nullptr, mpol_f_mems_allowed) != 0) {
+            return;
+        }
+
+        std::size_t nodes_count = 0;
+
+        for (unsigned long word: nodes) {
+            nodes_count += static_cast<std::size_t>(__builtin_popcountl(word));
+        }
+
+        if (nodes_count > 1) {
+            ::syscall(SYS_mbind, p, bytes, mpol_interleave, nodes.data(), max_nodes, 0);
+        }
+#else
+        (void) p;
+        (void) bytes;
+#endif
+    }
+
+    // Fresh zeroed pages aligned to the huge page size, nullptr if the mapping fails. Pages of
+    // the hugetlbfs pool when asked for and the pool has enough of them, otherwise a normal
+    // mapping the kernel backs with transparent huge pages where it can.
+    inline void *map(std::size_t bytes, bool hugetlbfs, NumaPlacement placement) {
+        void *p = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+        if (hugetlbfs) {
+            p = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        }
+#else
+        (void) hugetlbfs;
+#endif
+
+        if (p == MAP_FAILED) {
+            // a huge page more, to cut an aligned range out of it
+            void *mapping = ::mmap(nullptr, bytes + huge_page_size, PROT_READ | PROT_WRITE,
+                                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+            if (mapping == MAP_FAILED) {
+                return nullptr;
+            }
+
+            auto begin = reinterpret_cast<std::uintptr_t>(mapping);
+            auto aligned = (begin + huge_page_size - 1) & ~(huge_page_size - 1);
+
+            if (aligned != begin) {
+                ::munmap(mapping, aligned - begin);
+            }
+
+            if (std::size_t tail = huge_page_size - (aligned - begin)) {
+                ::munmap(reinterpret_cast<void *>(aligned + bytes), tail);
+            }
+
+            p = reinterpret_cast<void *>(aligned);
+
+#ifdef MADV_HUGEPAGE
+            ::madvise(p, bytes, MADV_HUGEPAGE);
+#endif
+        }
+
+        // before the first touch, the policy only applies to pages faulted in afterwards
+        if (placement == NumaPlacement::interleave) {
+            interleave(p, bytes);
+        }
+
+        return p;
+    }
+}
+
+// Standard allocator for the slot and bucket arrays of large tables: arrays of a huge page
+// or more are mapped on their own, aligned to and in multiples of the huge page size, so
+// a random probe costs one TLB entry per 2 MiB instead of per 4 KiB. With hugetlbfs the
+// pages come from the reserved pool, without it or when the pool is short the kernel is
+// asked for transparent huge pages. Smaller allocations, nodes among them, come from
+// calloc. Memory always comes zeroed. Stateless, all instances are equal.
+template<typename T, NumaPlacement placement = NumaPlacement::first_touch, bool hugetlbfs = false>
+class HugePageAllocator {
+public:
+    using value_type = T;
+
+    template<typename U>
+    struct rebind {
+        using other = HugePageAllocator<U, placement, hugetlbfs>;
+    };
+
+    HugePageAllocator() = default;
+
+    template<typename U>
+    HugePageAllocator(const HugePageAllocator<U, placement, hugetlbfs> &) noexcept {}
+
+    T *allocate(std::size_t n) {
+        std::size_t bytes = n * sizeof(T);
+
+        if (mapped(bytes)) {
+            if (void *p = huge_pages_detail::map(huge_pages_detail::round_up(bytes), hugetlbfs, placement)) {
+                return static_cast<T *>(p);
+            }
+
+            throw std::bad_alloc();
+        }
+
+        if constexpr (alignof(T) > alignof(std::max_align_t)) {
+            void *p = ::operator new(bytes, std::align_val_t(alignof(T)));
+            std::memset(p, 0, bytes);
+            return static_cast<T *>(p);
+        } else {
+            if (void *p = std::calloc(n, sizeof(T))) {
+                return static_cast<T *>(p);
+            }
+
+            throw std::bad_alloc();
+        }
+    }
+
+    void deallocate(T *p, std::size_t n) noexcept {
+        std::size_t bytes = n * sizeof(T);
+
+        if (mapped(bytes)) {
+            ::munmap(p, huge_pages_detail::round_up(bytes));
+        } else if constexpr (alignof(T) > alignof(std::max_align_t)) {
+            ::operator delete(p, std::align_val_t(alignof(T)));
+        } else {
+            std::free(p);
+        }
+    }
+
+    template<typename U>
+    bool operator==(const HugePageAllocator<U, placement, hugetlbfs> &) const noexcept {
+        return true;
+    }
+
+private:
+    static bool mapped(std::size_t bytes) {
+        return bytes >= huge_pages_detail::huge_page_size;
+    }
+};
+
+// Allocators whose memory comes zeroed, tables may skip clearing what they allocate.
+template<typename Allocator>
+constexpr bool allocates_zeroed_v = false;
+
+template<typename T, NumaPlacement placement, bool hugetlbfs>
+constexpr bool allocates_zeroed_v<HugePageAllocator<T, placement, hugetlbfs>> = true;
+
+#endif //UNTITLED3_HUGEPAGEALLOCATOR_H
@@ -2,81 +2,210 @@
 #define UNTITLED3_LINEARPROBINGHASHTABLE_H
 
 #include <cstddef>
+#include <atomic>
+#include <filesystem>
 #include <memory>
 #include <optional>
+#include <ranges>
+#include <span>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include <array>
+#include <algorithm>
 #include <cassert>
 #include <complex>
 #include "Hash.h"
-#include "PrimeNumbers.h"
+#include "CapacityPolicy.h"
+#include "SlotStorage.h"
+#include "Prefetch.h"
+#include "Stats.h"
+#include "Snapshot.h"
+#include "TableIterator.h"
+#include "RehashExecutor.h"
 
 static constexpr double linear_default_load_factor_limit = 0.8;
 
-template<typename K, typename V, template<typename> typename H, double load_factor_limit = linear_default_load_factor_limit> requires Hash<H, K>
+template<typename K, typename V, template<typename> typename H, double load_factor_limit = linear_default_load_factor_limit,
+        template<typename, typename, typename> typename Storage = NodeSlotStorage,
+        typename Capacity = PrimeCapacity,
+        typename Allocator = std::allocator<std::pair<const K, V>>,
+        typename Stats = NoStats> requires Hash<H, K>
 class LinearHashingHashTable {
-private:
-    struct Node {
-        explicit Node(std::pair<const K, V> kv) : kv(kv), isRemoved(false) {}
+public:
+    using key_type = K;
+    using mapped_type = V;
+    using hasher = H<K>;
+    using find_result = std::optional<std::reference_wrapper<std::pair<const K, V>>>;
+    using iterator = SlotIterator<LinearHashingHashTable, std::pair<const K, V>>;
+    using const_iterator = SlotIterator<const LinearHashingHashTable, const std::pair<const K, V>>;
+    using capacity_sized = void;
+
+    // a find that records into the stats writes to the table
+    static constexpr bool mutating_find = Stats::enabled;
+
+    explicit LinearHashingHashTable(const Allocator &allocator = Allocator()) :
+            size_i(0),
+            non_removed_size(0),
+            allocator(allocator),
+            slots(Capacity::size(0), allocator),
+            hash(H < K > {}) {}
+
+    template<std::ranges::input_range R>
+    requires std::constructible_from<std::pair<const K, V>, std::ranges::range_reference_t<R>> &&
+             (!std::same_as<std::remove_cvref_t<R>, LinearHashingHashTable>)
+    explicit LinearHashingHashTable(R &&range, const Allocator &allocator = Allocator()) :
+            LinearHashingHashTable(allocator) {
+        insert_range(std::forward<R>(range));
+    }
+
+    bool insert(std::pair<const K, V> &&kv) {
+        return emplace_key(kv.first, std::move(kv.second));
+    }
 
-        std::pair<const K, V> kv;
-        bool isRemoved;
+    // the pair is built first to get at its key, which is then moved into the table
+    template<typename... Args>
+    bool emplace(Args &&... args) {
+        std::pair<K, V> kv(std::forward<Args>(args)...);
+        return emplace_key(std::move(kv.first), std::move(kv.second));
+    }
 
-        const K &key() {
-            return kv.first;
-        }
+    // the value is constructed from args in place, and only if the key is absent
+    template<typename... Args>
+    bool try_emplace(const K &key, Args &&... args) {
+        return emplace_key(key, std::forward<Args>(args)...);
+    }
+
+    template<typename... Args>
+    bool try_emplace(K &&key, Args &&... args) {
+        return emplace_key(std::move(key), std::forward<Args>(args)...);
+    }
+
+    // false when the key was present and only its value was assigned
+    template<typename M>
+    bool insert_or_assign(const K &key, M &&value) {
+        return assign_key(key, std::forward<M>(value));
+    }
+
+    template<typename M>
+    bool insert_or_assign(K &&key, M &&value) {
+        return assign_key(std::move(key), std::forward<M>(value));
+    }
 
-        V &value() {
-            return kv.second;
+    // a sized range is reserved for once and inserted without per element load factor checks
+    template<std::ranges::input_range R>
+    requires std::constructible_from<std::pair<const K, V>, std::ranges::range_reference_t<R>>
+    void insert_range(R &&range) {
+        if constexpr (std::ranges::sized_range<R>) {
+            reserve(fullness() + std::ranges::size(range));
+
+            for (auto &&kv: range) {
+                std::pair<K, V> entry(std::forward<decltype(kv)>(kv));
+                emplace_without_rehash(std::move(entry.first), std::move(entry.second));
+            }
+        } else {
+            for (auto &&kv: range) {
+                emplace(std::forward<decltype(kv)>(kv));
+            }
         }
-    };
+    }
 
-public:
-    explicit LinearHashingHashTable() : size_i(0),
-                                        non_nullptr_size(0),
-                                        non_removed_size(0),
-                                        nodes(new Node *[prime_numbers[0]]),
-                                        hash(H < K > {}) {
-        std::fill(nodes, nodes + prime_numbers[0], nullptr);
+    // grows the table so that n entries fit below the load factor limit
+    void reserve(std::size_t n) {
+        std::size_t new_size_i = fitting_size_index<Capacity>(n, load_factor_limit);
+
+        if (new_size_i > size_i) {
+            rehash(new_size_i);
+        }
     }
 
-    bool insert(std::pair<const K, V> &&kv) {
-        if (load_factor() >= load_factor_limit) {
-            rehash();
+    // shrinks to the smallest capacity that holds the entries below the load factor limit
+    void shrink_to_fit() {
+        std::size_t new_size_i = std::min(size_i, fitting_size_index<Capacity>(fullness(), load_factor_limit));
+
+        if (new_size_i < size_i) {
+            rehash(new_size_i);
         }
+    }
 
-        return insert_without_rehash(std::move(kv));
+    // a remove that leaves the load factor below min_load_factor shrinks the table to where the
+    // entries fill half the limit; 0, the default, never shrinks. Capped at a quarter of the
+    // limit, so that neither a grow nor another shrink follows right away.
+    void set_shrink_load_factor(double min_load_factor) {
+        shrink_load_factor = std::min(min_load_factor, load_factor_limit / 4);
     }
 
-    std::optional<std::reference_wrapper<std::pair<const K, V>>> find(const K &key, std::size_t &probes_count) {
-        std::size_t h1 = hash(key);
-        std::size_t h = h1 % size();
+    template<LookupKey<H, K> Q = K>
+    std::optional<std::reference_wrapper<std::pair<const K, V>>> find(const Q &key, std::size_t &probes_count) {
+        const auto &lookup_key = as_lookup_key<H, K>(key);
+        std::size_t key_hash = hash(lookup_key);
+        return find_from(lookup_key, key_hash, Capacity::reduce(key_hash, size_i), probes_count);
+    }
 
-        for (std::size_t i = 0; i < size(); ++i, h = (h1 + i) % size(), ++probes_count) {
-            auto node = nodes[h];
+    template<LookupKey<H, K> Q = K>
+    find_result find(const Q &key) {
+        std::size_t probes_count = 0;
+        return find(key, probes_count);
+    }
 
-            if (!node) {
-                ++probes_count;
-                return {};
+    template<LookupKey<H, K> Q = K>
+    bool contains(const Q &key) {
+        std::size_t probes_count = 0;
+        return find(key, probes_count).has_value();
+    }
+
+    // hashes a group of keys and prefetches their slots before probing any of them, so
+    // the cache misses of the group overlap instead of being paid one after another
+    void find_batch(std::span<const K> keys, std::vector<find_result> &results, std::size_t &probes_count) {
+        results.resize(keys.size());
+        std::array<std::size_t, prefetch_batch_width> key_hashes;
+        std::array<std::size_t, prefetch_batch_width> homes;
+
+        for (std::size_t begin = 0; begin < keys.size(); begin += prefetch_batch_width) {
+            std::size_t count = std::min(prefetch_batch_width, keys.size() - begin);
+
+            for (std::size_t j = 0; j < count; ++j) {
+                key_hashes[j] = hash(keys[begin + j]);
+                homes[j] = Capacity::reduce(key_hashes[j], size_i);
+                slots.prefetch_slot(homes[j]);
             }
 
-            if (!node->isRemoved && node->key() == key) {
-                ++probes_count;
-                return {std::ref(node->kv)};
+            for (std::size_t j = 0; j < count; ++j) {
+                slots.prefetch_entry(homes[j]);
+            }
+
+            for (std::size_t j = 0; j < count; ++j) {
+                results[begin + j] = find_from(keys[begin + j], key_hashes[j], homes[j], probes_count);
             }
         }
+    }
 
-        return {};
+    void find_batch(std::span<const K> keys, std::vector<find_result> &results) {
+        std::size_t probes_count = 0;
+        find_batch(keys, results, probes_count);
     }
 
-    std::optional<std::pair<K, V>> remove(const K &key) {
-        std::size_t h1 = hash(key);
-        std::size_t h = h1 % size();
+    // backward shift deletion: entries after the removed one are moved back into the
+    // gap, so the table never holds tombstones
+    template<LookupKey<H, K> Q = K>
+    std::optional<std::pair<K, V>> remove(const Q &key) {
+        const auto &lookup_key = as_lookup_key<H, K>(key);
+        std::size_t key_hash = hash(lookup_key);
+        std::size_t h = Capacity::reduce(key_hash, size_i);
+
+        for (std::size_t i = 0; i < size(); i++, h = next_slot(h)) {
+            if (slots.empty(h)) {
+                return {};
+            }
 
-        for (std::size_t i = 0; i < size(); i++, h = (h1 + i) % size()) {
-            auto node = nodes[h];
+            if (slots.matches(h, key_hash, lookup_key)) {
+                std::pair<K, V> kv = slots.take(h);
 
-            if (node && !node->isRemoved && node->key() == key) {
-                node->isRemoved = true;
-                return {std::move(node->kv)};
+                close_gap(h);
+                --non_removed_size;
+                shrink_if_sparse();
+
+                return {std::move(kv)};
             }
         }
 
@@ -87,8 +216,8 @@ public:
         return non_removed_size;
     }
 
-    inline std::size_t size() {
-        return prime_numbers[size_i];
+    inline std::size_t size() const {
+        return Capacity::size(size_i);
     }
 
     double successful_probes_evaluation() {
@@ -105,90 +234,264 @@ public:
         return static_cast<double>(non_removed_size) / static_cast<double>(size());
     }
 
+    // see Snapshot.h, false if the file cannot be written
+    bool save(const std::filesystem::path &path) requires SnapshotStorage<Storage<K, V, Allocator>> {
+        SnapshotHeader header = snapshot_header(size_i);
+        header.counters = {non_removed_size};
+
+        return save_snapshot(path, header, slots.snapshot_sections());
+    }
+
+    // maps a snapshot saved by a table of the same type and probes its pages in place until
+    // the next rehash; false, with the table unchanged, if the file does not fit the table
+    bool load(const std::filesystem::path &path, bool verify_checksum = true)
+    requires SnapshotStorage<Storage<K, V, Allocator>> {
+        auto snapshot = load_snapshot(path, verify_checksum);
+
+        if (!snapshot || snapshot->header.size_i >= Capacity::count ||
+            !snapshot->header.matches(snapshot_header(snapshot->header.size_i))) {
+            return false;
+        }
+
+        size_i = snapshot->header.size_i;
+        non_removed_size = snapshot->header.counters[0];
+
+        Storage<K, V, Allocator> mapped(size(), std::move(snapshot->file), std::span(snapshot->sections).template first<3>(), allocator);
+        slots.swap(mapped);
+
+        return true;
+    }
+
+    // rehashes of at least parallel_rehash_min_size slots are split over the executor
+    void set_rehash_executor(RehashExecutor executor) {
+        rehash_executor = std::move(executor);
+    }
+
+    // lookup and rehash counters stay zero unless the table collects stats
+    TableStats stats() {
+        TableStats result = stats_policy.snapshot();
+        result.allocated_bytes = slots.allocated_bytes(non_removed_size);
+
+        return result;
+    }
+
+    // entries in slot order, empty and removed slots are skipped
+    iterator begin() {
+        return {this, 0, size()};
+    }
+
+    iterator end() {
+        return {this, size(), size()};
+    }
+
+    const_iterator begin() const {
+        return {this, 0, size()};
+    }
+
+    const_iterator end() const {
+        return {this, size(), size()};
+    }
+
+    // fn(kv) for every entry, the slot array split over threads
+    template<typename F>
+    void parallel_for_each(F fn, std::size_t threads = std::thread::hardware_concurrency()) {
+        parallel_for_each_position<iterator>(this, size(), fn, threads);
+    }
+
     void debug() {
         for (int i = 0; i < size(); i++) {
-            if (nodes[i] && !nodes[i]->isRemoved) {
-                std::cout << nodes[i]->key() << " " << nodes[i]->value() << "\n";
+            if (slots.full(i)) {
+                std::cout << slots.kv(i).first << " " << slots.kv(i).second << "\n";
             }
         }
         std::cout << std::endl;
     }
 
-    ~LinearHashingHashTable() {
-        for (int i = 0; i < size(); i++) {
-            delete nodes[i];
-        }
+private:
+    template<typename, typename> friend class SlotIterator;
 
-        delete[] nodes;
+    inline std::size_t next_full(std::size_t i, std::size_t end) const {
+        return slots.next_full(i, end);
     }
 
-private:
-    void rehash() {
-        std::size_t old_size = size();
-        size_i++;
-        non_removed_size = 0;
-        non_nullptr_size = 0;
+    inline std::pair<const K, V> &position_kv(std::size_t i) {
+        return slots.kv(i);
+    }
 
-        Node **buff = new Node *[size()];
+    inline const std::pair<const K, V> &position_kv(std::size_t i) const {
+        return slots.kv(i);
+    }
 
-        std::fill(buff, buff + size(), nullptr);
-        std::swap(nodes, buff);
+    template<typename Q>
+    find_result find_from(const Q &key, std::size_t key_hash, std::size_t h, std::size_t &probes_count) {
+        std::size_t first_probe = probes_count;
+        find_result result = probe_from(key, key_hash, h, probes_count);
 
-        for (int i = 0; i < old_size; i++) {
-            auto node = buff[i];
+        stats_policy.record_lookup(result.has_value(), probes_count - first_probe);
+        return result;
+    }
 
-            if (node && !node->isRemoved) {
-                insert_without_rehash(std::move(node->kv));
+    template<typename Q>
+    find_result probe_from(const Q &key, std::size_t key_hash, std::size_t h, std::size_t &probes_count) {
+        for (std::size_t i = 0; i < size(); ++i, h = next_slot(h), ++probes_count) {
+            if (slots.empty(h)) {
+                ++probes_count;
+                return {};
             }
 
-            delete node;
+            if (slots.matches(h, key_hash, key)) {
+                ++probes_count;
+                return {std::ref(slots.kv(h))};
+            }
         }
 
-        delete[] buff;
+        return {};
     }
 
-    bool insert_without_rehash(std::pair<const K, V> &&kv) {
-        std::size_t h1 = hash(kv.first);
-        std::size_t h = h1 % size();
+    SnapshotHeader snapshot_header(std::size_t i) {
+        auto bytes = Storage<K, V, Allocator>::snapshot_bytes(Capacity::size(i));
+        return make_snapshot_header<K, Entry<K, V>, Capacity>(SnapshotEngine::linear, i, hash, bytes);
+    }
 
-        for (std::size_t i = 0; i < size(); i++, h = (h1 + i) % size()) {
-            auto node = nodes[h];
+    // after a remove, see set_shrink_load_factor
+    void shrink_if_sparse() {
+        if (load_factor() < shrink_load_factor) {
+            std::size_t new_size_i = fitting_size_index<Capacity>(2 * fullness(), load_factor_limit);
 
-            if (node && !node->isRemoved && node->key() == kv.first) {
-                return false;
+            if (new_size_i < size_i) {
+                rehash(new_size_i);
             }
+        }
+    }
 
-            if (!node) {
-                nodes[h] = new Node(std::move(kv));
+    void rehash(std::size_t new_size_i) {
+        typename Stats::RehashTimer timer(stats_policy);
+        std::size_t old_size = size();
+        size_i = new_size_i;
 
-                ++non_removed_size;
-                ++non_nullptr_size;
-                return true;
+        Storage<K, V, Allocator> buff(size(), allocator);
+        slots.swap(buff);
+
+        if (rehash_executor && old_size >= parallel_rehash_min_size) {
+            std::atomic<std::size_t> moved = 0;
+
+            parallel_ranges(rehash_executor, old_size, [&](std::size_t begin, std::size_t end) {
+                moved.fetch_add(move_range<true>(buff, begin, end), std::memory_order_relaxed);
+            });
+
+            non_removed_size = moved.load(std::memory_order_relaxed);
+        } else {
+            non_removed_size = move_range<false>(buff, 0, old_size);
+        }
+    }
+
+    // moves the full slots of [begin, end) of the old storage to the first empty slot of their
+    // probe sequences, claimed atomically while other ranges are moved at once. Any order of
+    // moves leaves every entry behind an unbroken run of full slots from its home slot.
+    template<bool concurrent>
+    std::size_t move_range(Storage<K, V, Allocator> &old, std::size_t begin, std::size_t end) {
+        std::size_t moved = 0;
+
+        for (std::size_t i = begin; i < end; i++) {
+            if (old.full(i)) {
+                std::size_t h = Capacity::reduce(old.key_hash(i, hash), size_i);
+
+                if constexpr (concurrent) {
+                    while (!slots.try_transfer(h, old, i)) {
+                        h = next_slot(h);
+                    }
+                } else {
+                    while (!slots.empty(h)) {
+                        h = next_slot(h);
+                    }
+
+                    slots.transfer(h, old, i);
+                }
+
+                ++moved;
             }
+        }
+
+        return moved;
+    }
+
+    template<typename KK, typename... Args>
+    bool emplace_key(KK &&key, Args &&... args) {
+        if (load_factor() >= load_factor_limit) {
+            rehash(next_size_index<Capacity>(size_i));
+        }
+
+        return emplace_without_rehash(std::forward<KK>(key), std::forward<Args>(args)...);
+    }
+
+    template<typename KK, typename M>
+    bool assign_key(KK &&key, M &&value) {
+        std::size_t probes_count = 0;
+
+        if (auto kv = find(key, probes_count)) {
+            kv->get().second = std::forward<M>(value);
+            return false;
+        }
 
-            if (node->isRemoved) {
-                delete node;
-                nodes[h] = new Node(std::move(kv));
+        return emplace_key(std::forward<KK>(key), std::forward<M>(value));
+    }
+
+    template<typename KK, typename... Args>
+    bool emplace_without_rehash(KK &&key, Args &&... args) {
+        std::size_t key_hash = hash(key);
+        std::size_t h = Capacity::reduce(key_hash, size_i);
+
+        for (std::size_t i = 0; i < size(); i++, h = next_slot(h)) {
+            if (slots.empty(h)) {
+                slots.emplace(h, key_hash, std::piecewise_construct, std::forward_as_tuple(std::forward<KK>(key)),
+                              std::forward_as_tuple(std::forward<Args>(args)...));
 
                 ++non_removed_size;
                 return true;
             }
+
+            if (slots.matches(h, key_hash, key)) {
+                return false;
+            }
         }
 
         assert(true);
         return false;
     }
 
+    void close_gap(std::size_t gap) {
+        for (std::size_t j = next_slot(gap); !slots.empty(j); j = next_slot(j)) {
+            std::size_t home = Capacity::reduce(slots.key_hash(j, hash), size_i);
+
+            // the entry may move back only if the gap lies between its home slot and j
+            if (distance(home, j) >= distance(gap, j)) {
+                slots.relocate(j, gap);
+                gap = j;
+            }
+        }
+    }
+
+    inline std::size_t distance(std::size_t from, std::size_t to) {
+        return to >= from ? to - from : to + size() - from;
+    }
+
+    inline std::size_t next_slot(std::size_t h) {
+        return h + 1 < size() ? h + 1 : 0;
+    }
+
     inline std::size_t next_size() {
-        return prime_numbers[size_i + 1];
+        return Capacity::size(next_size_index<Capacity>(size_i));
     }
 
     std::size_t size_i;
-    std::size_t non_nullptr_size;
     std::size_t non_removed_size;
 
-    Node **nodes;
+    Allocator allocator;
+    Storage<K, V, Allocator> slots;
     H <K> hash;
+    RehashExecutor rehash_executor;
+    double shrink_load_factor = 0;
+    [[no_unique_address]] Stats stats_policy;
 };
 
 #endif //UNTITLED3_LINEARPROBINGHASHTABLE_H
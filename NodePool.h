@@ -0,0 +1,121 @@
+#ifndef UNTITLED3_NODEPOOL_H
+#define UNTITLED3_NODEPOOL_H
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <vector>
+#include <array>
+#include <type_traits>
+
+// Arena for small objects: memory is carved from large blocks, freed objects go on a
+// free list of their size class and are handed out again, blocks are only released
+// together when the pool is destroyed. Allocations above max_pooled_size (bucket and
+// slot arrays) are passed to operator new.
+class NodePool {
+public:
+    static constexpr std::size_t alignment = alignof(std::max_align_t);
+    static constexpr std::size_t max_pooled_size = 256;
+    static constexpr std::size_t block_size = std::size_t{1} << 20;
+
+    NodePool() : free_lists{}, cursor(nullptr), end(nullptr) {}
+
+    NodePool(const NodePool &) = delete;
+
+    NodePool &operator=(const NodePool &) = delete;
+
+    void *allocate(std::size_t bytes, std::size_t align) {
+        if (bytes > max_pooled_size || align > alignment) {
+            return ::operator new(bytes, std::align_val_t(align));
+        }
+
+        std::size_t size_class = (bytes + alignment - 1) / alignment - 1;
+
+        if (FreeNode *node = free_lists[size_class]) {
+            free_lists[size_class] = node->next;
+            return node;
+        }
+
+        std::size_t rounded_bytes = (size_class + 1) * alignment;
+
+        if (static_cast<std::size_t>(end - cursor) < rounded_bytes) {
+            cursor = static_cast<std::byte *>(::operator new(block_size, std::align_val_t(alignment)));
+            end = cursor + block_size;
+            blocks.push_back(cursor);
+        }
+
+        void *result = cursor;
+        cursor += rounded_bytes;
+
+        return result;
+    }
+
+    void deallocate(void *p, std::size_t bytes, std::size_t align) {
+        if (bytes > max_pooled_size || align > alignment) {
+            ::operator delete(p, std::align_val_t(align));
+            return;
+        }
+
+        std::size_t size_class = (bytes + alignment - 1) / alignment - 1;
+        free_lists[size_class] = ::new(p) FreeNode{free_lists[size_class]};
+    }
+
+    ~NodePool() {
+        for (std::byte *block: blocks) {
+            ::operator delete(block, std::align_val_t(alignment));
+        }
+    }
+
+private:
+    struct FreeNode {
+        FreeNode *next;
+    };
+
+    std::array<FreeNode *, max_pooled_size / alignment> free_lists;
+    std::byte *cursor;
+    std::byte *end;
+    std::vector<std::byte *> blocks;
+};
+
+// Standard allocator over a NodePool. Copies and rebound copies share the pool, so a
+// table can rebind it for its nodes and arrays and move nodes between arrays freely.
+// The pool lives as long as the last allocator referring to it.
+template<typename T>
+class PoolAllocator {
+public:
+    using value_type = T;
+
+    PoolAllocator() : pool(std::make_shared<NodePool>()) {}
+
+    template<typename U>
+    PoolAllocator(const PoolAllocator<U> &other) noexcept : pool(other.pool) {}
+
+    T *allocate(std::size_t n) {
+        return static_cast<T *>(pool->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T *p, std::size_t n) noexcept {
+        pool->deallocate(p, n * sizeof(T), alignof(T));
+    }
+
+    template<typename U>
+    bool operator==(const PoolAllocator<U> &other) const noexcept {
+        return pool == other.pool;
+    }
+
+private:
+    template<typename U>
+    friend class PoolAllocator;
+
+    std::shared_ptr<NodePool> pool;
+};
+
+// Allocators whose memory is released all at once when the last copy is destroyed,
+// tables may skip freeing trivially destructible nodes one by one.
+template<typename Allocator>
+constexpr bool releases_all_at_once_v = false;
+
+template<typename T>
+constexpr bool releases_all_at_once_v<PoolAllocator<T>> = true;
+
+#endif //UNTITLED3_NODEPOOL_H
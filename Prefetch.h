@@ -0,0 +1,18 @@
+#ifndef UNTITLED3_PREFETCH_H
+#define UNTITLED3_PREFETCH_H
+
+#include <cstddef>
+
+// padding unit for data written by different threads
+constexpr std::size_t cache_line_size = 64;
+
+// number of keys find_batch hashes and prefetches before it starts probing
+constexpr std::size_t prefetch_batch_width = 16;
+
+inline void prefetch(const void *address) {
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_prefetch(address);
+#endif
+}
+
+#endif //UNTITLED3_PREFETCH_H
@@ -2,11 +2,167 @@
 #define UNTITLED3_PRIMENUMBERS_H
 
 #include <array>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
 
-constexpr std::size_t prime_numbers_count = 26;
-constexpr auto prime_numbers = std::array<std::size_t, prime_numbers_count>{
-        53, 97, 193, 389, 769, 1543, 3079, 6151, 12289, 24593, 49157, 98317, 196613, 393241, 786433, 1572869,
-        3145739, 6291469, 12582917, 25165843, 50331653, 100663319, 201326611, 402653189, 805306457, 1610612741
+// (a * b) % n without overflow
+constexpr std::uint64_t multiply_mod(std::uint64_t a, std::uint64_t b, std::uint64_t n) {
+    return static_cast<std::uint64_t>(static_cast<unsigned __int128>(a) * b % n);
+}
+
+constexpr std::uint64_t power_mod(std::uint64_t base, std::uint64_t exponent, std::uint64_t n) {
+    std::uint64_t result = 1;
+    base %= n;
+
+    for (; exponent; exponent >>= 1) {
+        if (exponent & 1) {
+            result = multiply_mod(result, base, n);
+        }
+
+        base = multiply_mod(base, base, n);
+    }
+
+    return result;
+}
+
+// Miller-Rabin, deterministic below 2^64 with the first twelve primes as witnesses
+constexpr bool is_prime(std::uint64_t n) {
+    constexpr std::uint64_t witnesses[] = {2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37};
+
+    if (n < 2) {
+        return false;
+    }
+
+    for (std::uint64_t p: witnesses) {
+        if (n % p == 0) {
+            return n == p;
+        }
+    }
+
+    std::uint64_t d = n - 1;
+    int s = 0;
+
+    for (; d % 2 == 0; d /= 2) {
+        ++s;
+    }
+
+    for (std::uint64_t a: witnesses) {
+        std::uint64_t x = power_mod(a, d, n);
+
+        if (x == 1 || x == n - 1) {
+            continue;
+        }
+
+        int r = 1;
+
+        for (; r < s; ++r) {
+            x = multiply_mod(x, x, n);
+
+            if (x == n - 1) {
+                break;
+            }
+        }
+
+        if (r == s) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// the largest prime below 2^64
+constexpr std::uint64_t largest_prime = std::numeric_limits<std::uint64_t>::max() - 58;
+
+static_assert(is_prime(largest_prime) && is_prime(1610612741) && !is_prime(3215031751));
+
+// smallest prime >= n, for n <= largest_prime
+constexpr std::uint64_t next_prime(std::uint64_t n) {
+    while (!is_prime(n)) {
+        ++n;
+    }
+
+    return n;
+}
+
+// enough for growth factors down to 1.1
+constexpr std::size_t prime_numbers_max_count = 512;
+
+template<std::size_t N>
+struct PrimeSequence {
+    std::array<std::size_t, N> primes{};
+    std::size_t count = 0;
 };
 
+// From 53 up to largest_prime, each prime the smallest one at least numerator / denominator
+// times the one before. Runs at compile time for every growth factor a table is built with.
+template<std::size_t numerator, std::size_t denominator>
+constexpr PrimeSequence<prime_numbers_max_count> generate_prime_numbers() {
+    static_assert(numerator * 10 >= denominator * 11, "growth factor below 1.1");
+
+    PrimeSequence<prime_numbers_max_count> sequence;
+    std::uint64_t prime = 53;
+
+    for (;;) {
+        sequence.primes[sequence.count++] = prime;
+
+        if (prime == largest_prime) {
+            return sequence;
+        }
+
+        unsigned __int128 target = (static_cast<unsigned __int128>(prime) * numerator + denominator - 1) / denominator;
+        prime = target > largest_prime ? largest_prime : next_prime(static_cast<std::uint64_t>(target));
+    }
+}
+
+template<std::size_t numerator, std::size_t denominator>
+constexpr auto prime_numbers_sequence = generate_prime_numbers<numerator, denominator>();
+
+template<std::size_t numerator, std::size_t denominator>
+constexpr std::size_t prime_numbers_count = prime_numbers_sequence<numerator, denominator>.count;
+
+// prime table sizes growing by numerator / denominator per step
+template<std::size_t numerator, std::size_t denominator>
+constexpr auto prime_numbers = [] {
+    std::array<std::size_t, prime_numbers_count<numerator, denominator>> primes{};
+
+    for (std::size_t i = 0; i < primes.size(); ++i) {
+        primes[i] = prime_numbers_sequence<numerator, denominator>.primes[i];
+    }
+
+    return primes;
+}();
+
+// Lemire's fastmod: x % d == (((M * x) mod 2^128) * d) >> 128 for M = (2^128 - 1) / d + 1,
+// a reduction by a precomputed divisor costs multiplications instead of a division.
+constexpr unsigned __int128 fastmod_magic(std::size_t d) {
+    return ~static_cast<unsigned __int128>(0) / d + 1;
+}
+
+constexpr std::size_t fastmod(std::size_t x, unsigned __int128 magic, std::size_t d) {
+    unsigned __int128 low_bits = magic * x;
+
+    unsigned __int128 bottom_half = ((low_bits & ~std::size_t{0}) * d) >> 64;
+    unsigned __int128 top_half = (low_bits >> 64) * d;
+
+    return static_cast<std::size_t>((bottom_half + top_half) >> 64);
+}
+
+template<std::size_t numerator, std::size_t denominator>
+constexpr auto prime_magic_numbers = [] {
+    std::array<unsigned __int128, prime_numbers_count<numerator, denominator>> magic_numbers{};
+
+    for (std::size_t i = 0; i < magic_numbers.size(); ++i) {
+        magic_numbers[i] = fastmod_magic(prime_numbers<numerator, denominator>[i]);
+    }
+
+    return magic_numbers;
+}();
+
+static_assert(fastmod(~std::size_t{0}, fastmod_magic(53), 53) == ~std::size_t{0} % 53);
+static_assert(fastmod(1234567890123, fastmod_magic(1610612741), 1610612741) == 1234567890123 % 1610612741);
+static_assert(fastmod(~std::size_t{0} - 1, fastmod_magic(largest_prime), largest_prime) ==
+              (~std::size_t{0} - 1) % largest_prime);
+
 #endif //UNTITLED3_PRIMENUMBERS_H
@@ -0,0 +1,207 @@
+#ifndef UNTITLED3_READMOSTLYHASHTABLE_H
+#define UNTITLED3_READMOSTLYHASHTABLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#include <atomic>
+#include <concepts>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include "EpochReclaimer.h"
+#include "Prefetch.h"
+
+// Map for tables read from every core and written rarely, over one of the single-threaded
+// tables allocating through an EpochAllocator. Readers take no lock and never wait for a
+// writer, writers are serialized by a mutex.
+//
+// A write that fits into the current table is done in place and bracketed by a sequence
+// counter: a reader that saw the counter odd or changed repeats its lookup. In place writes
+// never rehash: the table is reserved for a number of entries up front and a write that
+// would go past it builds a new table instead, reserved for twice the entries, copies the
+// entries over and publishes it. Tables that rehash before they are full, like those
+// keeping tombstones, are rejected, and removes do not shrink the table. Readers still in the old table finish there; it is retired
+// to an EpochReclaimer together with the nodes and arrays the in place writes free, and
+// freed once no reader is pinned from before.
+//
+// A lookup that races with a write may read half written entries, keys and values are
+// trivially copyable so that those reads are harmless and thrown away. Lookups return
+// copies, a reference would be overwritten in place by the next write.
+template<typename Table>
+class ReadMostlyHashTable {
+    using K = typename Table::key_type;
+    using V = typename Table::mapped_type;
+    using Allocator = EpochAllocator<std::pair<const K, V>>;
+
+    static_assert(std::is_trivially_copyable_v<K> && std::is_trivially_copyable_v<V>,
+                  "readers may see entries half written");
+    static_assert(std::constructible_from<Table, const Allocator &>, "the table has to allocate through an EpochAllocator");
+    static_assert(!requires { requires Table::mutating_find; }, "finds run on many threads at once");
+    static_assert(!requires { requires Table::rehashes_below_load_factor_limit; },
+                  "in place writes must not rehash, inserts_left only counts entries");
+
+public:
+    ReadMostlyHashTable() : current(new Version(reclaimer)) {}
+
+    ReadMostlyHashTable(const ReadMostlyHashTable &) = delete;
+
+    ReadMostlyHashTable &operator=(const ReadMostlyHashTable &) = delete;
+
+    ~ReadMostlyHashTable() {
+        Version *version = current.load(std::memory_order_relaxed);
+        version->allocator.detach();
+        delete version;
+    }
+
+    bool insert(std::pair<const K, V> &&kv) {
+        std::lock_guard lock(writer_mutex);
+        Table &table = writable_table(kv.first);
+
+        bool inserted = write([&] { return table.insert(std::move(kv)); });
+        inserts_left -= inserted;
+
+        return inserted;
+    }
+
+    template<typename M>
+    bool insert_or_assign(const K &key, M &&value) {
+        std::lock_guard lock(writer_mutex);
+        Table &table = current.load(std::memory_order_relaxed)->table;
+
+        if (auto kv = table.find(key)) {
+            write([&] { kv->get().second = std::forward<M>(value); });
+            return false;
+        }
+
+        Table &target = writable_table(key);
+        write([&] { target.insert({key, std::forward<M>(value)}); });
+        --inserts_left;
+
+        return true;
+    }
+
+    template<typename Q = K>
+    std::optional<std::pair<K, V>> remove(const Q &key) {
+        std::lock_guard lock(writer_mutex);
+        Table &table = current.load(std::memory_order_relaxed)->table;
+
+        return write([&] { return table.remove(key); });
+    }
+
+    template<typename Q = K>
+    std::optional<V> find(const Q &key) {
+        auto guard = reclaimer.pin();
+
+        for (;;) {
+            std::uint64_t before = sequence.load(std::memory_order_acquire);
+
+            if (before % 2 == 0) {
+                // a table published meanwhile is only written once the counter has moved on
+                auto kv = current.load(std::memory_order_acquire)->table.find(key);
+                std::optional<V> result = kv ? std::optional<V>(kv->get().second) : std::nullopt;
+
+                // the reads above before the check below
+                std::atomic_thread_fence(std::memory_order_acquire);
+
+                if (sequence.load(std::memory_order_relaxed) == before) {
+                    return result;
+                }
+            }
+
+            std::this_thread::yield();
+        }
+    }
+
+    template<typename Q = K>
+    bool contains(const Q &key) {
+        return find(key).has_value();
+    }
+
+    std::size_t fullness() {
+        std::lock_guard lock(writer_mutex);
+        return current.load(std::memory_order_relaxed)->table.fullness();
+    }
+
+    // of the current table
+    std::size_t size() {
+        std::lock_guard lock(writer_mutex);
+        return current.load(std::memory_order_relaxed)->table.size();
+    }
+
+private:
+    // a table and its allocator, which has to be detached before the table is freed; removes
+    // never shrink the table, a shrink would rehash under the readers
+    struct Version {
+        explicit Version(EpochReclaimer &reclaimer) : allocator(reclaimer), table(allocator) {
+            if constexpr (requires { table.set_shrink_load_factor(0.); }) {
+                table.set_shrink_load_factor(0.);
+            }
+        }
+
+        Allocator allocator;
+        Table table;
+    };
+
+    // the sequence counter is odd while fn changes the current table in place
+    template<typename F>
+    decltype(auto) write(F &&fn) {
+        std::uint64_t before = sequence.load(std::memory_order_relaxed);
+        sequence.store(before + 1, std::memory_order_relaxed);
+
+        // the odd counter before any of the writes below
+        std::atomic_thread_fence(std::memory_order_release);
+
+        struct Done {
+            ~Done() {
+                sequence.store(before + 2, std::memory_order_release);
+            }
+
+            std::atomic<std::uint64_t> &sequence;
+            std::uint64_t before;
+        } done{sequence, before};
+
+        return fn();
+    }
+
+    // the current table if it takes one more entry in place, otherwise a new one with room
+    // for twice the entries; an insert of a key that is already there does not need room
+    Table &writable_table(const K &key) {
+        Version *version = current.load(std::memory_order_relaxed);
+
+        if (inserts_left > 0 || version->table.contains(key)) {
+            return version->table;
+        }
+
+        std::size_t reserved = 2 * (version->table.fullness() + 1);
+        auto *next = new Version(reclaimer);
+        next->table.reserve(reserved);
+
+        for (const auto &[k, v]: std::as_const(version->table)) {
+            next->table.insert({k, v});
+        }
+
+        inserts_left = reserved - next->table.fullness();
+        current.store(next, std::memory_order_release);
+
+        reclaimer.retire([version] {
+            version->allocator.detach();
+            delete version;
+        });
+
+        return next->table;
+    }
+
+    // before current, it frees what the versions retire to it
+    EpochReclaimer reclaimer;
+
+    alignas(cache_line_size) std::atomic<std::uint64_t> sequence{0};
+    std::atomic<Version *> current;
+
+    alignas(cache_line_size) std::mutex writer_mutex;
+    std::size_t inserts_left = 0;
+};
+
+#endif //UNTITLED3_READMOSTLYHASHTABLE_H
@@ -0,0 +1,55 @@
+#ifndef UNTITLED3_REHASHEXECUTOR_H
+#define UNTITLED3_REHASHEXECUTOR_H
+
+#include <cstddef>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <vector>
+
+// Runs task(i) for every i below count and returns once all of them have finished, on
+// threads of the caller's choosing. A table given one moves the old array to the new one
+// in count ranges at once, a table without one rehashes on the calling thread. The hasher
+// is then called from several threads at once.
+using RehashExecutor = std::function<void(std::size_t count, const std::function<void(std::size_t)> &task)>;
+
+// smaller tables are rehashed on the calling thread even with an executor
+static constexpr std::size_t parallel_rehash_min_size = std::size_t{1} << 16;
+
+// old slots or buckets per task
+static constexpr std::size_t parallel_rehash_range = std::size_t{1} << 14;
+
+// body(begin, end) for consecutive ranges covering [0, size)
+template<typename F>
+void parallel_ranges(const RehashExecutor &executor, std::size_t size, F &&body) {
+    std::size_t count = (size + parallel_rehash_range - 1) / parallel_rehash_range;
+
+    executor(count, [&](std::size_t i) {
+        body(i * parallel_rehash_range, std::min(size, (i + 1) * parallel_rehash_range));
+    });
+}
+
+// for callers without a pool of their own: starts the threads for every rehash, they take
+// tasks off a shared counter
+inline RehashExecutor thread_rehash_executor(std::size_t threads = std::thread::hardware_concurrency()) {
+    return [threads](std::size_t count, const std::function<void(std::size_t)> &task) {
+        std::atomic<std::size_t> next = 0;
+
+        auto work = [&] {
+            for (std::size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < count;) {
+                task(i);
+            }
+        };
+
+        std::vector<std::jthread> workers;
+
+        for (std::size_t t = 1; t < std::min(threads, count); ++t) {
+            workers.emplace_back(work);
+        }
+
+        work();
+    };
+}
+
+#endif //UNTITLED3_REHASHEXECUTOR_H
@@ -0,0 +1,547 @@
+#ifndef UNTITLED3_ROBINHOODHASHINGHASHTABLE_H
+#define UNTITLED3_ROBINHOODHASHINGHASHTABLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <ranges>
+#include <span>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <cassert>
+#include <complex>
+#include "Hash.h"
+#include "CapacityPolicy.h"
+#include "SlotStorage.h"
+#include "Prefetch.h"
+#include "Stats.h"
+#include "Snapshot.h"
+#include "TableIterator.h"
+
+static constexpr double robin_hood_default_load_factor_limit = 0.9;
+
+// Linear probing where every full slot remembers its distance from the home slot.
+// An insert takes the slot of any entry that is closer to its home ("richer") than
+// the inserted one and carries that entry on, so distances stay even. A search can
+// stop at the first slot whose entry is closer to home than the current distance.
+template<typename K, typename V, template<typename> typename H, double load_factor_limit = robin_hood_default_load_factor_limit,
+        template<typename, typename, typename> typename Storage = NodeSlotStorage,
+        typename Capacity = PrimeCapacity,
+        typename Allocator = std::allocator<std::pair<const K, V>>,
+        typename Stats = NoStats> requires Hash<H, K>
+class RobinHoodHashingHashTable {
+public:
+    using key_type = K;
+    using mapped_type = V;
+    using hasher = H<K>;
+    using find_result = std::optional<std::reference_wrapper<std::pair<const K, V>>>;
+    using iterator = SlotIterator<RobinHoodHashingHashTable, std::pair<const K, V>>;
+    using const_iterator = SlotIterator<const RobinHoodHashingHashTable, const std::pair<const K, V>>;
+    using capacity_sized = void;
+
+    // a find that records into the stats writes to the table
+    static constexpr bool mutating_find = Stats::enabled;
+
+    explicit RobinHoodHashingHashTable(const Allocator &allocator = Allocator()) :
+            size_i(0),
+            non_removed_size(0),
+            max_distance(0),
+            allocator(allocator),
+            slots(Capacity::size(0), allocator),
+            distances(new std::uint32_t[Capacity::size(0)]),
+            hash(H < K > {}) {}
+
+    template<std::ranges::input_range R>
+    requires std::constructible_from<std::pair<const K, V>, std::ranges::range_reference_t<R>> &&
+             (!std::same_as<std::remove_cvref_t<R>, RobinHoodHashingHashTable>)
+    explicit RobinHoodHashingHashTable(R &&range, const Allocator &allocator = Allocator()) :
+            RobinHoodHashingHashTable(allocator) {
+        insert_range(std::forward<R>(range));
+    }
+
+    RobinHoodHashingHashTable(const RobinHoodHashingHashTable &) = delete;
+
+    RobinHoodHashingHashTable &operator=(const RobinHoodHashingHashTable &) = delete;
+
+    bool insert(std::pair<const K, V> &&kv) {
+        return emplace_key(kv.first, std::move(kv.second));
+    }
+
+    // the pair is built first to get at its key, which is then moved into the table
+    template<typename... Args>
+    bool emplace(Args &&... args) {
+        std::pair<K, V> kv(std::forward<Args>(args)...);
+        return emplace_key(std::move(kv.first), std::move(kv.second));
+    }
+
+    // the value is constructed from args in place, and only if the key is absent
+    template<typename... Args>
+    bool try_emplace(const K &key, Args &&... args) {
+        return emplace_key(key, std::forward<Args>(args)...);
+    }
+
+    template<typename... Args>
+    bool try_emplace(K &&key, Args &&... args) {
+        return emplace_key(std::move(key), std::forward<Args>(args)...);
+    }
+
+    // false when the key was present and only its value was assigned
+    template<typename M>
+    bool insert_or_assign(const K &key, M &&value) {
+        return assign_key(key, std::forward<M>(value));
+    }
+
+    template<typename M>
+    bool insert_or_assign(K &&key, M &&value) {
+        return assign_key(std::move(key), std::forward<M>(value));
+    }
+
+    // a sized range is reserved for once and inserted without per element load factor checks
+    template<std::ranges::input_range R>
+    requires std::constructible_from<std::pair<const K, V>, std::ranges::range_reference_t<R>>
+    void insert_range(R &&range) {
+        if constexpr (std::ranges::sized_range<R>) {
+            reserve(fullness() + std::ranges::size(range));
+
+            for (auto &&kv: range) {
+                std::pair<K, V> entry(std::forward<decltype(kv)>(kv));
+                emplace_without_rehash(std::move(entry.first), std::move(entry.second));
+            }
+        } else {
+            for (auto &&kv: range) {
+                emplace(std::forward<decltype(kv)>(kv));
+            }
+        }
+    }
+
+    // grows the table so that n entries fit below the load factor limit
+    void reserve(std::size_t n) {
+        std::size_t new_size_i = fitting_size_index<Capacity>(n, load_factor_limit);
+
+        if (new_size_i > size_i) {
+            rehash(new_size_i);
+        }
+    }
+
+    // shrinks to the smallest capacity that holds the entries below the load factor limit
+    void shrink_to_fit() {
+        std::size_t new_size_i = std::min(size_i, fitting_size_index<Capacity>(fullness(), load_factor_limit));
+
+        if (new_size_i < size_i) {
+            rehash(new_size_i);
+        }
+    }
+
+    // a remove that leaves the load factor below min_load_factor shrinks the table to where the
+    // entries fill half the limit; 0, the default, never shrinks. Capped at a quarter of the
+    // limit, so that neither a grow nor another shrink follows right away.
+    void set_shrink_load_factor(double min_load_factor) {
+        shrink_load_factor = std::min(min_load_factor, load_factor_limit / 4);
+    }
+
+    template<LookupKey<H, K> Q = K>
+    std::optional<std::reference_wrapper<std::pair<const K, V>>> find(const Q &key, std::size_t &probes_count) {
+        const auto &lookup_key = as_lookup_key<H, K>(key);
+        std::size_t key_hash = hash(lookup_key);
+        return find_from(lookup_key, key_hash, Capacity::reduce(key_hash, size_i), probes_count);
+    }
+
+    template<LookupKey<H, K> Q = K>
+    find_result find(const Q &key) {
+        std::size_t probes_count = 0;
+        return find(key, probes_count);
+    }
+
+    template<LookupKey<H, K> Q = K>
+    bool contains(const Q &key) {
+        std::size_t probes_count = 0;
+        return find(key, probes_count).has_value();
+    }
+
+    // hashes a group of keys and prefetches their slots before probing any of them, so
+    // the cache misses of the group overlap instead of being paid one after another
+    void find_batch(std::span<const K> keys, std::vector<find_result> &results, std::size_t &probes_count) {
+        results.resize(keys.size());
+        std::array<std::size_t, prefetch_batch_width> key_hashes;
+        std::array<std::size_t, prefetch_batch_width> homes;
+
+        for (std::size_t begin = 0; begin < keys.size(); begin += prefetch_batch_width) {
+            std::size_t count = std::min(prefetch_batch_width, keys.size() - begin);
+
+            for (std::size_t j = 0; j < count; ++j) {
+                key_hashes[j] = hash(keys[begin + j]);
+                homes[j] = Capacity::reduce(key_hashes[j], size_i);
+                slots.prefetch_slot(homes[j]);
+                prefetch(distances + homes[j]);
+            }
+
+            for (std::size_t j = 0; j < count; ++j) {
+                slots.prefetch_entry(homes[j]);
+            }
+
+            for (std::size_t j = 0; j < count; ++j) {
+                results[begin + j] = find_from(keys[begin + j], key_hashes[j], homes[j], probes_count);
+            }
+        }
+    }
+
+    void find_batch(std::span<const K> keys, std::vector<find_result> &results) {
+        std::size_t probes_count = 0;
+        find_batch(keys, results, probes_count);
+    }
+
+    // backward shift deletion, entries after the removed one move one slot closer to home
+    template<LookupKey<H, K> Q = K>
+    std::optional<std::pair<K, V>> remove(const Q &key) {
+        const auto &lookup_key = as_lookup_key<H, K>(key);
+        std::size_t probes_count = 0;
+        std::size_t key_hash = hash(lookup_key);
+        auto h = find_slot_from(lookup_key, key_hash, Capacity::reduce(key_hash, size_i), probes_count);
+
+        if (!h) {
+            return {};
+        }
+
+        std::size_t gap = *h;
+        std::pair<K, V> removed_kv = slots.take(gap);
+
+        for (std::size_t j = next_slot(gap); !slots.empty(j) && distances[j] > 0; j = next_slot(j)) {
+            slots.relocate(j, gap);
+            distances[gap] = distances[j] - 1;
+            gap = j;
+        }
+
+        --non_removed_size;
+        shrink_if_sparse();
+
+        return {std::move(removed_kv)};
+    }
+
+    std::size_t fullness() {
+        return non_removed_size;
+    }
+
+    inline std::size_t size() const {
+        return Capacity::size(size_i);
+    }
+
+    // Robin Hood only reorders the entries of a cluster, so a hit costs the same as in linear probing
+    double successful_probes_evaluation() {
+        auto alpha = static_cast<double>(fullness()) / static_cast<double>(size());
+        return (1. / 2) * (1. + 1. / (1. - alpha));
+    }
+
+    // a miss stops at the first richer entry instead of the end of the cluster; clusters are
+    // sorted by home slot, and in such ordered tables a miss costs what a hit does (Amble
+    // and Knuth), not the (1 + 1 / (1 - alpha)^2) / 2 of plain linear probing
+    double failed_probes_evaluation() {
+        auto alpha = static_cast<double>(fullness()) / static_cast<double>(size());
+        return (1. / 2) * (1. + 1. / (1. - alpha));
+    }
+
+    inline double load_factor() {
+        return static_cast<double>(non_removed_size) / static_cast<double>(size());
+    }
+
+    // see Snapshot.h, false if the file cannot be written
+    bool save(const std::filesystem::path &path) requires SnapshotStorage<Storage<K, V, Allocator>> {
+        SnapshotHeader header = snapshot_header(size_i);
+        header.counters = {non_removed_size, max_distance};
+
+        auto storage_sections = slots.snapshot_sections();
+        std::array<std::span<const std::byte>, 4> sections{storage_sections[0], storage_sections[1], storage_sections[2],
+                                                           std::as_bytes(std::span(distances, size()))};
+
+        return save_snapshot(path, header, sections);
+    }
+
+    // maps a snapshot saved by a table of the same type and probes its pages in place until
+    // the next rehash; false, with the table unchanged, if the file does not fit the table
+    bool load(const std::filesystem::path &path, bool verify_checksum = true)
+    requires SnapshotStorage<Storage<K, V, Allocator>> {
+        auto snapshot = load_snapshot(path, verify_checksum);
+
+        if (!snapshot || snapshot->header.size_i >= Capacity::count ||
+            !snapshot->header.matches(snapshot_header(snapshot->header.size_i))) {
+            return false;
+        }
+
+        size_i = snapshot->header.size_i;
+        non_removed_size = snapshot->header.counters[0];
+        max_distance = static_cast<std::uint32_t>(snapshot->header.counters[1]);
+
+        Storage<K, V, Allocator> mapped(size(), snapshot->file, std::span(snapshot->sections).template first<3>(), allocator);
+        slots.swap(mapped);
+
+        release_distances();
+        distances = reinterpret_cast<std::uint32_t *>(snapshot->sections[3]);
+        distances_mapping = std::move(snapshot->file);
+
+        return true;
+    }
+
+    // lookup and rehash counters stay zero unless the table collects stats
+    TableStats stats() {
+        TableStats result = stats_policy.snapshot();
+        result.allocated_bytes = slots.allocated_bytes(non_removed_size) + size() * sizeof(std::uint32_t);
+
+        return result;
+    }
+
+    // entries in slot order, empty and removed slots are skipped
+    iterator begin() {
+        return {this, 0, size()};
+    }
+
+    iterator end() {
+        return {this, size(), size()};
+    }
+
+    const_iterator begin() const {
+        return {this, 0, size()};
+    }
+
+    const_iterator end() const {
+        return {this, size(), size()};
+    }
+
+    // fn(kv) for every entry, the slot array split over threads
+    template<typename F>
+    void parallel_for_each(F fn, std::size_t threads = std::thread::hardware_concurrency()) {
+        parallel_for_each_position<iterator>(this, size(), fn, threads);
+    }
+
+    void debug() {
+        for (std::size_t i = 0; i < size(); i++) {
+            if (slots.full(i)) {
+                std::cout << slots.kv(i).first << " " << slots.kv(i).second << "\n";
+            }
+        }
+        std::cout << std::endl;
+    }
+
+    ~RobinHoodHashingHashTable() {
+        release_distances();
+    }
+
+private:
+    template<typename, typename> friend class SlotIterator;
+
+    inline std::size_t next_full(std::size_t i, std::size_t end) const {
+        return slots.next_full(i, end);
+    }
+
+    inline std::pair<const K, V> &position_kv(std::size_t i) {
+        return slots.kv(i);
+    }
+
+    inline const std::pair<const K, V> &position_kv(std::size_t i) const {
+        return slots.kv(i);
+    }
+
+    template<typename Q>
+    find_result find_from(const Q &key, std::size_t key_hash, std::size_t h, std::size_t &probes_count) {
+        std::size_t first_probe = probes_count;
+        auto slot = find_slot_from(key, key_hash, h, probes_count);
+
+        stats_policy.record_lookup(slot.has_value(), probes_count - first_probe);
+
+        if (slot) {
+            return {std::ref(slots.kv(*slot))};
+        }
+
+        return {};
+    }
+
+    template<typename Q>
+    std::optional<std::size_t> find_slot_from(const Q &key, std::size_t key_hash, std::size_t h, std::size_t &probes_count) {
+        for (std::uint32_t d = 0; d <= max_distance; ++d, h = next_slot(h), ++probes_count) {
+            if (slots.empty(h) || distances[h] < d) {
+                ++probes_count;
+                return {};
+            }
+
+            if (distances[h] == d && slots.matches(h, key_hash, key)) {
+                ++probes_count;
+                return {h};
+            }
+        }
+
+        return {};
+    }
+
+    SnapshotHeader snapshot_header(std::size_t i) {
+        auto storage_bytes = Storage<K, V, Allocator>::snapshot_bytes(Capacity::size(i));
+        std::array<std::size_t, 4> bytes{storage_bytes[0], storage_bytes[1], storage_bytes[2],
+                                         Capacity::size(i) * sizeof(std::uint32_t)};
+
+        return make_snapshot_header<K, Entry<K, V>, Capacity>(SnapshotEngine::robin_hood, i, hash, bytes);
+    }
+
+    // the distances of a loaded snapshot go with its mapping
+    void release_distances() {
+        if (distances_mapping) {
+            distances_mapping.reset();
+        } else {
+            delete[] distances;
+        }
+    }
+
+    // after a remove, see set_shrink_load_factor
+    void shrink_if_sparse() {
+        if (load_factor() < shrink_load_factor) {
+            std::size_t new_size_i = fitting_size_index<Capacity>(2 * fullness(), load_factor_limit);
+
+            if (new_size_i < size_i) {
+                rehash(new_size_i);
+            }
+        }
+    }
+
+    void rehash(std::size_t new_size_i) {
+        typename Stats::RehashTimer timer(stats_policy);
+        std::size_t old_size = size();
+        size_i = new_size_i;
+        non_removed_size = 0;
+        max_distance = 0;
+
+        Storage<K, V, Allocator> buff(size(), allocator);
+        slots.swap(buff);
+
+        std::uint32_t *old_distances = distances;
+        std::shared_ptr<MappedFile> old_mapping = std::move(distances_mapping);
+        distances = new std::uint32_t[size()];
+
+        // nodes change hands and flat entries are moved, nothing is rebuilt
+        for (std::size_t i = 0; i < old_size; i++) {
+            if (buff.full(i)) {
+                auto [h, d] = insert_position(buff.key_hash(i, hash));
+                slots.transfer(h, buff, i);
+                set_distance(h, d);
+                ++non_removed_size;
+            }
+        }
+
+        if (!old_mapping) {
+            delete[] old_distances;
+        }
+    }
+
+    template<typename KK, typename... Args>
+    bool emplace_key(KK &&key, Args &&... args) {
+        if (load_factor() >= load_factor_limit) {
+            rehash(next_size_index<Capacity>(size_i));
+        }
+
+        return emplace_without_rehash(std::forward<KK>(key), std::forward<Args>(args)...);
+    }
+
+    template<typename KK, typename M>
+    bool assign_key(KK &&key, M &&value) {
+        std::size_t probes_count = 0;
+
+        if (auto kv = find(key, probes_count)) {
+            kv->get().second = std::forward<M>(value);
+            return false;
+        }
+
+        return emplace_key(std::forward<KK>(key), std::forward<M>(value));
+    }
+
+    template<typename KK, typename... Args>
+    bool emplace_without_rehash(KK &&key, Args &&... args) {
+        std::size_t key_hash = hash(key);
+        return emplace_hashed(key_hash, std::forward<KK>(key), std::forward<Args>(args)...);
+    }
+
+    template<typename KK, typename... Args>
+    bool emplace_hashed(std::size_t key_hash, KK &&key, Args &&... args) {
+        std::size_t h = Capacity::reduce(key_hash, size_i);
+        std::uint32_t d = 0;
+
+        for (; !slots.empty(h) && distances[h] >= d; ++d, h = next_slot(h)) {
+            if (distances[h] == d && slots.matches(h, key_hash, key)) {
+                return false;
+            }
+        }
+
+        ++non_removed_size;
+
+        if (!slots.empty(h)) {
+            displace(h);
+        }
+
+        slots.emplace(h, key_hash, std::piecewise_construct, std::forward_as_tuple(std::forward<KK>(key)),
+                      std::forward_as_tuple(std::forward<Args>(args)...));
+        set_distance(h, d);
+
+        return true;
+    }
+
+    // the slot a key that is not in the table goes to, and its distance there; the slot is
+    // empty or holds a richer entry
+    std::pair<std::size_t, std::uint32_t> insert_position(std::size_t key_hash) {
+        std::size_t h = Capacity::reduce(key_hash, size_i);
+        std::uint32_t d = 0;
+
+        for (; !slots.empty(h) && distances[h] >= d; ++d, h = next_slot(h)) {}
+
+        if (!slots.empty(h)) {
+            displace(h);
+        }
+
+        return {h, d};
+    }
+
+    // Empties h, which holds a richer entry, by carrying that entry on: it is parked in the
+    // empty slot ending the cluster and exchanged with every entry richer than it on the way
+    // there. Entries only swap slots, nodes are neither freed nor allocated.
+    void displace(std::size_t h) {
+        std::size_t end = next_slot(h);
+
+        while (!slots.empty(end)) {
+            end = next_slot(end);
+        }
+
+        std::uint32_t carried_distance = distances[h];
+        slots.relocate(h, end);
+
+        for (std::size_t j = next_slot(h); j != end; j = next_slot(j)) {
+            if (distances[j] < ++carried_distance) {
+                slots.exchange(j, end);
+                std::swap(distances[j], carried_distance);
+                max_distance = std::max(max_distance, distances[j]);
+            }
+        }
+
+        set_distance(end, carried_distance + 1);
+    }
+
+    inline void set_distance(std::size_t h, std::uint32_t d) {
+        distances[h] = d;
+        max_distance = std::max(max_distance, d);
+    }
+
+    inline std::size_t next_slot(std::size_t h) {
+        return h + 1 < size() ? h + 1 : 0;
+    }
+
+    std::size_t size_i;
+    std::size_t non_removed_size;
+    std::uint32_t max_distance;
+
+    Allocator allocator;
+    Storage<K, V, Allocator> slots;
+    std::uint32_t *distances;
+    std::shared_ptr<MappedFile> distances_mapping;
+    H <K> hash;
+    double shrink_load_factor = 0;
+    [[no_unique_address]] Stats stats_policy;
+};
+
+#endif //UNTITLED3_ROBINHOODHASHINGHASHTABLE_H
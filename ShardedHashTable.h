@@ -0,0 +1,263 @@
+#ifndef UNTITLED3_SHARDEDHASHTABLE_H
+#define UNTITLED3_SHARDEDHASHTABLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "Prefetch.h"
+#include "Stats.h"
+
+// Test and test-and-set lock for short critical sections. Readers take it exclusively
+// too, lock_shared is only there so it can stand in for std::shared_mutex.
+class SpinLock {
+public:
+    void lock() {
+        for (std::size_t spins = 0; locked.exchange(true, std::memory_order_acquire); ++spins) {
+            while (locked.load(std::memory_order_relaxed)) {
+                if (++spins % 64 == 0) {
+                    std::this_thread::yield();
+                }
+            }
+        }
+    }
+
+    bool try_lock() {
+        return !locked.load(std::memory_order_relaxed) && !locked.exchange(true, std::memory_order_acquire);
+    }
+
+    void unlock() {
+        locked.store(false, std::memory_order_release);
+    }
+
+    void lock_shared() {
+        lock();
+    }
+
+    bool try_lock_shared() {
+        return try_lock();
+    }
+
+    void unlock_shared() {
+        unlock();
+    }
+
+private:
+    std::atomic<bool> locked{false};
+};
+
+// Thread-safe map over any of the single-threaded tables. Keys are split between Shards
+// independent tables by the high bits of their mixed hash (the tables themselves use the
+// low bits), every shard has its own lock on its own cache line. Lookups return copies,
+// a reference into a shard would dangle as soon as its lock is released.
+template<typename Table, std::size_t Shards = 64, typename Lock = std::shared_mutex>
+class ShardedHashTable {
+    static_assert(std::has_single_bit(Shards), "shard count must be a power of two");
+
+    using K = typename Table::key_type;
+    using V = typename Table::mapped_type;
+
+public:
+    ShardedHashTable() : hash() {}
+
+    ShardedHashTable(const ShardedHashTable &) = delete;
+
+    ShardedHashTable &operator=(const ShardedHashTable &) = delete;
+
+    bool insert(std::pair<const K, V> &&kv) {
+        Shard &shard = shard_of(kv.first);
+        std::unique_lock lock(shard.lock);
+
+        return shard.table.insert(std::move(kv));
+    }
+
+    // the key decides the shard, so the pair is built before any lock is taken
+    template<typename... Args>
+    bool emplace(Args &&... args) {
+        std::pair<K, V> kv(std::forward<Args>(args)...);
+        return try_emplace(std::move(kv.first), std::move(kv.second));
+    }
+
+    template<typename... Args>
+    bool try_emplace(const K &key, Args &&... args) {
+        Shard &shard = shard_of(key);
+        std::unique_lock lock(shard.lock);
+
+        return shard.table.try_emplace(key, std::forward<Args>(args)...);
+    }
+
+    template<typename... Args>
+    bool try_emplace(K &&key, Args &&... args) {
+        Shard &shard = shard_of(key);
+        std::unique_lock lock(shard.lock);
+
+        return shard.table.try_emplace(std::move(key), std::forward<Args>(args)...);
+    }
+
+    template<typename M>
+    bool insert_or_assign(const K &key, M &&value) {
+        Shard &shard = shard_of(key);
+        std::unique_lock lock(shard.lock);
+
+        return shard.table.insert_or_assign(key, std::forward<M>(value));
+    }
+
+    template<typename M>
+    bool insert_or_assign(K &&key, M &&value) {
+        Shard &shard = shard_of(key);
+        std::unique_lock lock(shard.lock);
+
+        return shard.table.insert_or_assign(std::move(key), std::forward<M>(value));
+    }
+
+    template<typename Q = K>
+    std::optional<V> find(const Q &key, std::size_t &probes_count) {
+        Shard &shard = shard_of(key);
+
+        // a find that writes to its table (incremental resize, stats) may not run next to another one
+        if constexpr (mutating_find) {
+            std::unique_lock lock(shard.lock);
+            return copy(shard.table.find(key, probes_count));
+        } else {
+            ReadLock lock(shard.lock);
+            return copy(shard.table.find(key, probes_count));
+        }
+    }
+
+    template<typename Q = K>
+    std::optional<V> find(const Q &key) {
+        std::size_t probes_count = 0;
+        return find(key, probes_count);
+    }
+
+    template<typename Q = K>
+    bool contains(const Q &key) {
+        return find(key).has_value();
+    }
+
+    template<typename Q = K>
+    std::optional<std::pair<K, V>> remove(const Q &key) {
+        Shard &shard = shard_of(key);
+        std::unique_lock lock(shard.lock);
+
+        return shard.table.remove(key);
+    }
+
+    // every shard is reserved for its share of n entries
+    void reserve(std::size_t n) {
+        for (Shard &shard: shards) {
+            std::unique_lock lock(shard.lock);
+            shard.table.reserve((n + Shards - 1) / Shards);
+        }
+    }
+
+    // shard by shard, each under its write lock
+    void shrink_to_fit() {
+        for (Shard &shard: shards) {
+            std::unique_lock lock(shard.lock);
+            shard.table.shrink_to_fit();
+        }
+    }
+
+    // every shard shrinks on its own load factor
+    void set_shrink_load_factor(double min_load_factor) {
+        for (Shard &shard: shards) {
+            std::unique_lock lock(shard.lock);
+            shard.table.set_shrink_load_factor(min_load_factor);
+        }
+    }
+
+    // not a snapshot, shards are counted one after another
+    std::size_t fullness() {
+        std::size_t result = 0;
+
+        for (Shard &shard: shards) {
+            ReadLock lock(shard.lock);
+            result += shard.table.fullness();
+        }
+
+        return result;
+    }
+
+    // fn(kv) for every entry, kv is const: whole shards are split over threads and each one is
+    // walked under its read lock, writers to the other shards go on meanwhile
+    template<typename F>
+    void parallel_for_each(F fn, std::size_t threads = std::thread::hardware_concurrency()) {
+        threads = std::clamp<std::size_t>(threads, 1, Shards);
+
+        auto walk = [&](std::size_t t) {
+            for (std::size_t s = Shards * t / threads; s < Shards * (t + 1) / threads; ++s) {
+                ReadLock lock(shards[s].lock);
+
+                for (const auto &kv: std::as_const(shards[s].table)) {
+                    fn(kv);
+                }
+            }
+        };
+
+        std::vector<std::jthread> workers;
+
+        for (std::size_t t = 1; t < threads; ++t) {
+            workers.emplace_back(walk, t);
+        }
+
+        walk(0);
+    }
+
+    // summed over the shards, one after another like fullness
+    TableStats stats() requires requires(Table &table) { table.stats(); } {
+        TableStats result;
+
+        for (Shard &shard: shards) {
+            ReadLock lock(shard.lock);
+            result += shard.table.stats();
+        }
+
+        return result;
+    }
+
+private:
+    static constexpr bool mutating_find = requires { requires Table::mutating_find; };
+
+    // plain mutexes are taken exclusively by readers too
+    using ReadLock = std::conditional_t<requires(Lock &lock) { lock.lock_shared(); },
+            std::shared_lock<Lock>, std::unique_lock<Lock>>;
+
+    struct alignas(cache_line_size) Shard {
+        Lock lock;
+        Table table;
+    };
+
+    template<typename R>
+    static std::optional<V> copy(const R &result) {
+        if (result) {
+            return {result->get().second};
+        }
+
+        return {};
+    }
+
+    template<typename Q>
+    Shard &shard_of(const Q &key) {
+        if constexpr (Shards == 1) {
+            return shards[0];
+        } else {
+            std::uint64_t mixed = static_cast<std::uint64_t>(hash(key)) * 0x9E3779B97F4A7C15ull;
+            return shards[mixed >> (64 - std::countr_zero(Shards))];
+        }
+    }
+
+    std::array<Shard, Shards> shards;
+    typename Table::hasher hash;
+};
+
+#endif //UNTITLED3_SHARDEDHASHTABLE_H
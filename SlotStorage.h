@@ -0,0 +1,469 @@
+#ifndef UNTITLED3_SLOTSTORAGE_H
+#define UNTITLED3_SLOTSTORAGE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <utility>
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <atomic>
+#include <span>
+#include <type_traits>
+#include "Prefetch.h"
+#include "Entry.h"
+#include "Hash.h"
+#include "Snapshot.h"
+#include "HugePageAllocator.h"
+
+// Slot storages for the open addressing tables. A storage owns `capacity` slots,
+// every slot is either empty, full or removed (tombstone). All memory comes from
+// Allocator rebound to the storage's internal types. Full slots keep the hash of their
+// key when stores_hash<K> is set, the tables pass it in with every emplace.
+
+// storages whose arrays can be saved as a snapshot and mapped back, see Snapshot.h
+template<typename S>
+concept SnapshotStorage = requires(const S &storage) { storage.snapshot_sections(); };
+
+// Every slot is a pointer to a separately allocated node.
+template<typename K, typename V, typename Allocator = std::allocator<std::pair<const K, V>>>
+class NodeSlotStorage {
+private:
+    struct Node {
+        template<typename... Args>
+        explicit Node(std::size_t key_hash, Args &&... args) : hash(key_hash), isRemoved(false) {
+            entry.construct(std::forward<Args>(args)...);
+        }
+
+        ~Node() requires std::is_trivially_destructible_v<std::pair<K, V>> = default;
+
+        ~Node() {
+            entry.destroy();
+        }
+
+        Entry<K, V> entry;
+        [[no_unique_address]] StoredHash<stores_hash<K>> hash;
+        bool isRemoved;
+    };
+
+    using NodeAllocator = typename std::allocator_traits<Allocator>::template rebind_alloc<Node>;
+    using NodeTraits = std::allocator_traits<NodeAllocator>;
+    using ArrayAllocator = typename std::allocator_traits<Allocator>::template rebind_alloc<Node *>;
+
+public:
+    explicit NodeSlotStorage(std::size_t capacity, const Allocator &allocator = Allocator()) :
+            capacity(capacity),
+            node_allocator(allocator),
+            nodes(ArrayAllocator(allocator).allocate(capacity)) {
+        if constexpr (!allocates_zeroed_v<ArrayAllocator>) {
+            std::fill(nodes, nodes + capacity, nullptr);
+        }
+    }
+
+    NodeSlotStorage(const NodeSlotStorage &) = delete;
+
+    NodeSlotStorage &operator=(const NodeSlotStorage &) = delete;
+
+    inline bool empty(std::size_t i) const {
+        return !nodes[i];
+    }
+
+    inline bool removed(std::size_t i) const {
+        return nodes[i] && nodes[i]->isRemoved;
+    }
+
+    // the table knows how many slots hold a node, full and removed ones alike
+    inline std::size_t allocated_bytes(std::size_t nodes_count) const {
+        return capacity * sizeof(Node *) + nodes_count * sizeof(Node);
+    }
+
+    inline bool full(std::size_t i) const {
+        return nodes[i] && !nodes[i]->isRemoved;
+    }
+
+    inline const K &key(std::size_t i) const {
+        return nodes[i]->entry.kv.first;
+    }
+
+    inline std::pair<const K, V> &kv(std::size_t i) {
+        return nodes[i]->entry.kv;
+    }
+
+    inline const std::pair<const K, V> &kv(std::size_t i) const {
+        return nodes[i]->entry.kv;
+    }
+
+    // first full slot in [i, end), end if there is none
+    inline std::size_t next_full(std::size_t i, std::size_t end) const {
+        while (i < end && !full(i)) {
+            ++i;
+        }
+
+        return i;
+    }
+
+    // slot must be full, the stored hash is compared first
+    template<typename Q>
+    inline bool matches(std::size_t i, std::size_t key_hash, const Q &key) const {
+        return nodes[i]->hash.matches(key_hash) && nodes[i]->entry.kv.first == key;
+    }
+
+    // slot must be full, the key is hashed only if its hash is not stored
+    template<typename Hasher>
+    inline std::size_t key_hash(std::size_t i, Hasher &hash) const {
+        return nodes[i]->hash.get(key(i), hash);
+    }
+
+    // prefetch_slot brings in the slot itself, prefetch_entry what it points to
+    inline void prefetch_slot(std::size_t i) const {
+        prefetch(nodes + i);
+    }
+
+    inline void prefetch_entry(std::size_t i) const {
+        prefetch(nodes[i]);
+    }
+
+    // slot must be empty or removed, the pair is constructed from args
+    template<typename... Args>
+    void emplace(std::size_t i, std::size_t key_hash, Args &&... args) {
+        delete_node(nodes[i]);
+        nodes[i] = new_node(key_hash, std::forward<Args>(args)...);
+    }
+
+    // slot must be full, it becomes removed
+    std::pair<K, V> remove(std::size_t i) {
+        nodes[i]->isRemoved = true;
+        return nodes[i]->entry.extract();
+    }
+
+    // slot must be full, it becomes empty
+    std::pair<K, V> take(std::size_t i) {
+        std::pair<K, V> kv = nodes[i]->entry.extract();
+
+        delete_node(nodes[i]);
+        nodes[i] = nullptr;
+
+        return kv;
+    }
+
+    // from must be full and to empty, from becomes empty
+    void relocate(std::size_t from, std::size_t to) {
+        nodes[to] = nodes[from];
+        nodes[from] = nullptr;
+    }
+
+    // both slots must be full, their nodes trade places
+    void exchange(std::size_t i, std::size_t j) {
+        std::swap(nodes[i], nodes[j]);
+    }
+
+    // like relocate, from a slot of another storage, the node itself changes hands
+    void transfer(std::size_t to, NodeSlotStorage &other, std::size_t from) {
+        nodes[to] = other.nodes[from];
+        other.nodes[from] = nullptr;
+    }
+
+    // transfer into to only if it is empty, the slot is claimed atomically so that several
+    // threads can transfer into one storage at once while nothing else touches it
+    bool try_transfer(std::size_t to, NodeSlotStorage &other, std::size_t from) {
+        std::atomic_ref<Node *> slot(nodes[to]);
+        Node *expected = nullptr;
+
+        if (slot.load(std::memory_order_relaxed) || !slot.compare_exchange_strong(expected, other.nodes[from],
+                                                                                   std::memory_order_relaxed)) {
+            return false;
+        }
+
+        other.nodes[from] = nullptr;
+        return true;
+    }
+
+    void swap(NodeSlotStorage &other) noexcept {
+        std::swap(capacity, other.capacity);
+        std::swap(node_allocator, other.node_allocator);
+        std::swap(nodes, other.nodes);
+    }
+
+    ~NodeSlotStorage() {
+        for (std::size_t i = 0; i < capacity; ++i) {
+            delete_node(nodes[i]);
+        }
+
+        ArrayAllocator(node_allocator).deallocate(nodes, capacity);
+    }
+
+private:
+    template<typename... Args>
+    Node *new_node(Args &&... args) {
+        Node *node = NodeTraits::allocate(node_allocator, 1);
+        NodeTraits::construct(node_allocator, node, std::forward<Args>(args)...);
+        return node;
+    }
+
+    void delete_node(Node *node) {
+        if (node) {
+            NodeTraits::destroy(node_allocator, node);
+            NodeTraits::deallocate(node_allocator, node, 1);
+        }
+    }
+
+    std::size_t capacity;
+    NodeAllocator node_allocator;
+    Node **nodes;
+};
+
+// Key/value pairs are stored inline in one contiguous array, slot states are kept in
+// a separate byte array so a probe touches the pair itself only when the slot is full.
+// Stored hashes get a third array, a probe reaches the pair only when the hash matches.
+// Entries are moved between slots with their keys moved, not copied.
+template<typename K, typename V, typename Allocator = std::allocator<std::pair<const K, V>>>
+class FlatSlotStorage {
+private:
+    enum class State : std::uint8_t {
+        empty, full, removed
+    };
+
+    using value_type = std::pair<const K, V>;
+    using SlotAllocator = typename std::allocator_traits<Allocator>::template rebind_alloc<Entry<K, V>>;
+    using StateAllocator = typename std::allocator_traits<Allocator>::template rebind_alloc<State>;
+    using HashAllocator = typename std::allocator_traits<Allocator>::template rebind_alloc<std::size_t>;
+
+    static constexpr bool stores_hashes = stores_hash<K>;
+
+public:
+    explicit FlatSlotStorage(std::size_t capacity, const Allocator &allocator = Allocator()) :
+            capacity(capacity),
+            slot_allocator(allocator),
+            states(StateAllocator(allocator).allocate(capacity)),
+            hashes(stores_hashes ? HashAllocator(allocator).allocate(capacity) : nullptr),
+            slots(slot_allocator.allocate(capacity)) {
+        // zeroed pages are left untouched, they are placed by the first thread writing them
+        if constexpr (!allocates_zeroed_v<StateAllocator>) {
+            std::fill(states, states + capacity, State::empty);
+        }
+    }
+
+    // uses the arrays of a mapped snapshot in place, in the order of snapshot_sections;
+    // they are released with the mapping, not the allocator
+    FlatSlotStorage(std::size_t capacity, std::shared_ptr<MappedFile> mapping, std::span<std::byte *const, 3> sections,
+                    const Allocator &allocator = Allocator()) :
+            capacity(capacity),
+            slot_allocator(allocator),
+            states(reinterpret_cast<State *>(sections[0])),
+            hashes(stores_hashes ? reinterpret_cast<std::size_t *>(sections[1]) : nullptr),
+            slots(reinterpret_cast<Entry<K, V> *>(sections[2])),
+            mapping(std::move(mapping)) {}
+
+    FlatSlotStorage(const FlatSlotStorage &) = delete;
+
+    FlatSlotStorage &operator=(const FlatSlotStorage &) = delete;
+
+    inline bool empty(std::size_t i) const {
+        return states[i] == State::empty;
+    }
+
+    inline bool removed(std::size_t i) const {
+        return states[i] == State::removed;
+    }
+
+    inline std::size_t allocated_bytes(std::size_t) const {
+        return capacity * (sizeof(State) + (stores_hashes ? sizeof(std::size_t) : 0) + sizeof(Entry<K, V>));
+    }
+
+    inline bool full(std::size_t i) const {
+        return states[i] == State::full;
+    }
+
+    inline const K &key(std::size_t i) const {
+        return slots[i].kv.first;
+    }
+
+    inline value_type &kv(std::size_t i) {
+        return slots[i].kv;
+    }
+
+    inline const value_type &kv(std::size_t i) const {
+        return slots[i].kv;
+    }
+
+    // first full slot in [i, end), end if there is none; eight states are tested at once,
+    // full is the only state with the lowest bit set
+    inline std::size_t next_full(std::size_t i, std::size_t end) const {
+        constexpr std::uint64_t full_bits = 0x0101010101010101ull;
+
+        for (; i + sizeof(full_bits) <= end; i += sizeof(full_bits)) {
+            std::uint64_t word;
+            std::memcpy(&word, states + i, sizeof(word));
+
+            if (std::uint64_t mask = word & full_bits) {
+                return i + (std::endian::native == std::endian::little ? std::countr_zero(mask)
+                                                                        : std::countl_zero(mask)) / 8;
+            }
+        }
+
+        while (i < end && states[i] != State::full) {
+            ++i;
+        }
+
+        return i;
+    }
+
+    template<typename Q>
+    inline bool matches(std::size_t i, std::size_t key_hash, const Q &key) const {
+        if constexpr (stores_hashes) {
+            return hashes[i] == key_hash && slots[i].kv.first == key;
+        } else {
+            return slots[i].kv.first == key;
+        }
+    }
+
+    template<typename Hasher>
+    inline std::size_t key_hash(std::size_t i, Hasher &hash) const {
+        if constexpr (stores_hashes) {
+            return hashes[i];
+        } else {
+            return hash(key(i));
+        }
+    }
+
+    inline void prefetch_slot(std::size_t i) const {
+        prefetch(states + i);
+        if constexpr (stores_hashes) {
+            prefetch(hashes + i);
+        }
+        prefetch(slots + i);
+    }
+
+    inline void prefetch_entry(std::size_t) const {}
+
+    // states, hashes (empty unless stored) and slots
+    std::array<std::span<const std::byte>, 3> snapshot_sections() const requires SnapshotEntry<K, V> {
+        return {std::as_bytes(std::span(states, capacity)),
+                std::as_bytes(std::span(hashes, stores_hashes ? capacity : 0)),
+                std::as_bytes(std::span(slots, capacity))};
+    }
+
+    static std::array<std::size_t, 3> snapshot_bytes(std::size_t capacity) {
+        return {capacity * sizeof(State), stores_hashes ? capacity * sizeof(std::size_t) : 0,
+                capacity * sizeof(Entry<K, V>)};
+    }
+
+    template<typename... Args>
+    void emplace(std::size_t i, std::size_t key_hash, Args &&... args) {
+        slots[i].construct(std::forward<Args>(args)...);
+        states[i] = State::full;
+
+        if constexpr (stores_hashes) {
+            hashes[i] = key_hash;
+        }
+    }
+
+    std::pair<K, V> remove(std::size_t i) {
+        std::pair<K, V> kv = slots[i].extract();
+
+        slots[i].destroy();
+        states[i] = State::removed;
+
+        return kv;
+    }
+
+    std::pair<K, V> take(std::size_t i) {
+        std::pair<K, V> kv = slots[i].extract();
+
+        slots[i].destroy();
+        states[i] = State::empty;
+
+        return kv;
+    }
+
+    void relocate(std::size_t from, std::size_t to) {
+        transfer(to, *this, from);
+    }
+
+    void exchange(std::size_t i, std::size_t j) {
+        std::pair<K, V> kv = slots[i].extract();
+        slots[i].destroy();
+
+        slots[i].construct(slots[j].extract());
+        slots[j].destroy();
+        slots[j].construct(std::move(kv));
+
+        if constexpr (stores_hashes) {
+            std::swap(hashes[i], hashes[j]);
+        }
+    }
+
+    void transfer(std::size_t to, FlatSlotStorage &other, std::size_t from) {
+        slots[to].construct(other.slots[from].extract());
+        other.slots[from].destroy();
+
+        states[to] = State::full;
+        other.states[from] = State::empty;
+
+        if constexpr (stores_hashes) {
+            hashes[to] = other.hashes[from];
+        }
+    }
+
+    bool try_transfer(std::size_t to, FlatSlotStorage &other, std::size_t from) {
+        std::atomic_ref<State> state(states[to]);
+        State expected = State::empty;
+
+        if (state.load(std::memory_order_relaxed) != State::empty ||
+            !state.compare_exchange_strong(expected, State::full, std::memory_order_relaxed)) {
+            return false;
+        }
+
+        slots[to].construct(other.slots[from].extract());
+        other.slots[from].destroy();
+        other.states[from] = State::empty;
+
+        if constexpr (stores_hashes) {
+            hashes[to] = other.hashes[from];
+        }
+
+        return true;
+    }
+
+    void swap(FlatSlotStorage &other) noexcept {
+        std::swap(capacity, other.capacity);
+        std::swap(slot_allocator, other.slot_allocator);
+        std::swap(states, other.states);
+        std::swap(hashes, other.hashes);
+        std::swap(slots, other.slots);
+        std::swap(mapping, other.mapping);
+    }
+
+    ~FlatSlotStorage() {
+        for (std::size_t i = 0; i < capacity; ++i) {
+            if (states[i] == State::full) {
+                slots[i].destroy();
+            }
+        }
+
+        if (mapping) {
+            return;
+        }
+
+        slot_allocator.deallocate(slots, capacity);
+        StateAllocator(slot_allocator).deallocate(states, capacity);
+
+        if constexpr (stores_hashes) {
+            HashAllocator(slot_allocator).deallocate(hashes, capacity);
+        }
+    }
+
+private:
+    std::size_t capacity;
+    SlotAllocator slot_allocator;
+    State *states;
+    std::size_t *hashes;
+    Entry<K, V> *slots;
+
+    // set while the arrays are those of a loaded snapshot
+    std::shared_ptr<MappedFile> mapping;
+};
+
+#endif //UNTITLED3_SLOTSTORAGE_H
@@ -0,0 +1,302 @@
+#ifndef UNTITLED3_SNAPSHOT_H
+#define UNTITLED3_SNAPSHOT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+#include <typeinfo>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Binary snapshots of the flat tables. A file is a header followed by the table's arrays,
+// each at a multiple of snapshot_alignment and written as it is in memory. A load maps the
+// file copy-on-write and the table probes the mapped arrays in place: loading costs the
+// checksum pass at most, pages are read in by the probes that first touch them and copied
+// only when written to. A snapshot is meant to be read back by the build that wrote it.
+
+static constexpr std::size_t snapshot_alignment = 64;
+static constexpr std::size_t snapshot_max_sections = 4;
+
+// entries that can be written out and used again as raw bytes, pointers among them are
+// the caller's business
+template<typename K, typename V>
+concept SnapshotEntry = std::is_trivially_copyable_v<K> && std::is_trivially_copyable_v<V>;
+
+enum class SnapshotEngine : std::uint32_t {
+    linear = 1, double_hashing = 2, robin_hood = 3
+};
+
+struct SnapshotHeader {
+    static constexpr std::array<char, 8> expected_magic{'U', '3', 'S', 'N', 'A', 'P', '0', '1'};
+
+    std::array<char, 8> magic = expected_magic;
+    SnapshotEngine engine{};
+    std::uint32_t sections_count = 0;
+
+    // growth step of the capacity policy, an index into prime_numbers for a PrimeGrowthCapacity
+    std::uint64_t size_i = 0;
+    std::uint64_t capacity_id = 0;
+    std::uint64_t entry_id = 0;
+    std::uint64_t hash_id = 0;
+
+    std::array<std::uint64_t, snapshot_max_sections> section_bytes{};
+
+    // the table's own counters, stored as they are
+    std::array<std::uint64_t, 2> counters{};
+
+    // of the sections, one after another
+    std::uint64_t checksum = 0;
+
+    // all but the counters and the checksum have to agree between a file and the table loading it
+    bool matches(const SnapshotHeader &other) const {
+        return magic == other.magic && engine == other.engine && sections_count == other.sections_count &&
+               size_i == other.size_i && capacity_id == other.capacity_id && entry_id == other.entry_id &&
+               hash_id == other.hash_id && section_bytes == other.section_bytes;
+    }
+};
+
+// FNV-1a, for the identities below
+inline std::uint64_t fnv1a(std::span<const std::byte> bytes, std::uint64_t h = 0xcbf29ce484222325ull) {
+    for (std::byte b: bytes) {
+        h = (h ^ static_cast<std::uint8_t>(b)) * 0x100000001b3ull;
+    }
+
+    return h;
+}
+
+template<typename T>
+inline std::uint64_t fnv1a_value(const T &value, std::uint64_t h) {
+    return fnv1a(std::as_bytes(std::span(&value, 1)), h);
+}
+
+// name, size and alignment of a type; names are the same only within one compiler
+template<typename T>
+std::uint64_t type_identity() {
+    std::string_view name = typeid(T).name();
+    std::uint64_t h = fnv1a(std::as_bytes(std::span(name.data(), name.size())));
+
+    h = fnv1a_value(sizeof(T), h);
+    return fnv1a_value(alignof(T), h);
+}
+
+// A hasher is known by its type and by the hashes of two fixed keys, which also tells apart
+// std::hash of different standard libraries and seeded hashers with different seeds.
+template<typename K, typename Hasher>
+requires std::is_trivially_copyable_v<K>
+std::uint64_t hash_identity(Hasher &hash) {
+    std::uint64_t h = type_identity<Hasher>();
+
+    for (std::uint8_t fill: {0x00, 0x01}) {
+        std::array<std::byte, sizeof(K)> bytes;
+        bytes.fill(std::byte{fill});
+
+        h = fnv1a_value(static_cast<std::uint64_t>(hash(std::bit_cast<K>(bytes))), h);
+    }
+
+    return h;
+}
+
+// the header a table at growth step size_i expects, sections in the order the table saves them
+template<typename K, typename Entry, typename Capacity, typename Hasher>
+SnapshotHeader make_snapshot_header(SnapshotEngine engine, std::size_t size_i, Hasher &hash,
+                                    std::span<const std::size_t> section_bytes) {
+    SnapshotHeader header;
+
+    header.engine = engine;
+    header.sections_count = static_cast<std::uint32_t>(section_bytes.size());
+    header.size_i = size_i;
+    header.capacity_id = type_identity<Capacity>();
+    header.entry_id = type_identity<Entry>();
+    header.hash_id = hash_identity<K>(hash);
+    std::copy(section_bytes.begin(), section_bytes.end(), header.section_bytes.begin());
+
+    return header;
+}
+
+// four independent lanes so that the multiplications overlap, a few GB/s
+inline std::uint64_t snapshot_checksum(std::span<const std::byte> bytes, std::uint64_t seed) {
+    constexpr std::uint64_t prime = 0x9E3779B97F4A7C15ull;
+    std::array<std::uint64_t, 4> lanes{seed, seed + 1, seed + 2, seed + 3};
+
+    std::size_t i = 0;
+
+    for (; i + sizeof(lanes) <= bytes.size(); i += sizeof(lanes)) {
+        for (std::size_t j = 0; j < lanes.size(); ++j) {
+            std::uint64_t word;
+            std::memcpy(&word, bytes.data() + i + j * sizeof(word), sizeof(word));
+            lanes[j] = std::rotl((lanes[j] ^ word) * prime, 31);
+        }
+    }
+
+    std::uint64_t h = fnv1a_value(bytes.size(), seed);
+
+    for (std::uint64_t lane: lanes) {
+        h = (h ^ lane) * prime;
+    }
+
+    return fnv1a(bytes.subspan(i), h);
+}
+
+inline std::size_t snapshot_align(std::size_t offset) {
+    return (offset + snapshot_alignment - 1) / snapshot_alignment * snapshot_alignment;
+}
+
+// A private writable mapping of a whole file: pages are shared with the page cache until
+// written, the file itself never changes.
+class MappedFile {
+public:
+    // null if the file cannot be opened or mapped
+    static std::shared_ptr<MappedFile> open(const std::filesystem::path &path) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+        if (fd < 0) {
+            return nullptr;
+        }
+
+        struct stat st{};
+        void *data = MAP_FAILED;
+
+        if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+            data = ::mmap(nullptr, static_cast<std::size_t>(st.st_size), PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        }
+
+        // the mapping keeps the file alive
+        ::close(fd);
+
+        if (data == MAP_FAILED) {
+            return nullptr;
+        }
+
+        return std::shared_ptr<MappedFile>(new MappedFile(static_cast<std::byte *>(data),
+                                                          static_cast<std::size_t>(st.st_size)));
+    }
+
+    MappedFile(const MappedFile &) = delete;
+
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    inline std::byte *data() const {
+        return bytes;
+    }
+
+    inline std::size_t size() const {
+        return length;
+    }
+
+    ~MappedFile() {
+        ::munmap(bytes, length);
+    }
+
+private:
+    MappedFile(std::byte *bytes, std::size_t length) : bytes(bytes), length(length) {}
+
+    std::byte *bytes;
+    std::size_t length;
+};
+
+// the sections of a mapped snapshot, in the order they were saved
+struct LoadedSnapshot {
+    std::shared_ptr<MappedFile> file;
+    SnapshotHeader header{};
+    std::array<std::byte *, snapshot_max_sections> sections{};
+};
+
+// Writes to a temporary file next to path and renames it over path, so a table still
+// mapping the old file keeps its pages. The header's sizes and checksum are filled in here.
+inline bool save_snapshot(const std::filesystem::path &path, SnapshotHeader header,
+                          std::span<const std::span<const std::byte>> sections) {
+    if (sections.size() > snapshot_max_sections) {
+        return false;
+    }
+
+    header.sections_count = static_cast<std::uint32_t>(sections.size());
+    header.checksum = 0;
+
+    for (std::size_t i = 0; i < sections.size(); ++i) {
+        header.section_bytes[i] = sections[i].size();
+        header.checksum = snapshot_checksum(sections[i], header.checksum);
+    }
+
+    std::filesystem::path temp = path;
+    temp += ".tmp";
+
+    std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+    std::array<char, snapshot_alignment> padding{};
+    std::size_t offset = sizeof(header);
+
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+
+    for (std::span<const std::byte> section: sections) {
+        out.write(padding.data(), static_cast<std::streamsize>(snapshot_align(offset) - offset));
+        out.write(reinterpret_cast<const char *>(section.data()), static_cast<std::streamsize>(section.size()));
+        offset = snapshot_align(offset) + section.size();
+    }
+
+    out.close();
+
+    std::error_code error;
+
+    if (!out || (std::filesystem::rename(temp, path, error), error)) {
+        std::filesystem::remove(temp, error);
+        return false;
+    }
+
+    return true;
+}
+
+// empty if the file is not a complete snapshot or, when verified, its checksum is off;
+// whether it fits a table is up to the table to check against the header
+inline std::optional<LoadedSnapshot> load_snapshot(const std::filesystem::path &path, bool verify_checksum) {
+    LoadedSnapshot snapshot{MappedFile::open(path)};
+
+    if (!snapshot.file || snapshot.file->size() < sizeof(SnapshotHeader)) {
+        return {};
+    }
+
+    std::memcpy(&snapshot.header, snapshot.file->data(), sizeof(SnapshotHeader));
+
+    const SnapshotHeader &header = snapshot.header;
+
+    if (header.magic != SnapshotHeader::expected_magic || header.sections_count > snapshot_max_sections) {
+        return {};
+    }
+
+    std::size_t offset = sizeof(SnapshotHeader);
+    std::uint64_t checksum = 0;
+
+    for (std::size_t i = 0; i < header.sections_count; ++i) {
+        offset = snapshot_align(offset);
+
+        if (offset > snapshot.file->size() || header.section_bytes[i] > snapshot.file->size() - offset) {
+            return {};
+        }
+
+        snapshot.sections[i] = snapshot.file->data() + offset;
+        offset += header.section_bytes[i];
+
+        if (verify_checksum) {
+            checksum = snapshot_checksum({snapshot.sections[i], header.section_bytes[i]}, checksum);
+        }
+    }
+
+    if (verify_checksum && checksum != header.checksum) {
+        return {};
+    }
+
+    return snapshot;
+}
+
+#endif //UNTITLED3_SNAPSHOT_H
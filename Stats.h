@@ -0,0 +1,123 @@
+#ifndef UNTITLED3_STATS_H
+#define UNTITLED3_STATS_H
+
+#include <cstddef>
+#include <algorithm>
+#include <array>
+#include <chrono>
+
+// Snapshot returned by the tables' stats(). Lookup and rehash counters are only filled in
+// by CollectStats, tombstones and allocated bytes are read off the table's state.
+struct TableStats {
+    // a lookup of that many probes is counted at that index, longer ones at the last index
+    static constexpr std::size_t histogram_size = 32;
+
+    std::array<std::size_t, histogram_size> successful_histogram{};
+    std::array<std::size_t, histogram_size> failed_histogram{};
+
+    std::size_t successful_lookups = 0;
+    std::size_t successful_probes = 0;
+    std::size_t failed_lookups = 0;
+    std::size_t failed_probes = 0;
+    std::size_t max_probes = 0;
+
+    std::size_t tombstones = 0;
+    std::size_t rehash_count = 0;
+    std::chrono::nanoseconds rehash_time{0};
+
+    // slot arrays and nodes, without allocator overhead
+    std::size_t allocated_bytes = 0;
+
+    // comparable with successful_probes_evaluation and failed_probes_evaluation
+    double average_successful_probes() const {
+        return successful_lookups ? static_cast<double>(successful_probes) / static_cast<double>(successful_lookups) : 0;
+    }
+
+    double average_failed_probes() const {
+        return failed_lookups ? static_cast<double>(failed_probes) / static_cast<double>(failed_lookups) : 0;
+    }
+
+    TableStats &operator+=(const TableStats &other) {
+        for (std::size_t i = 0; i < histogram_size; ++i) {
+            successful_histogram[i] += other.successful_histogram[i];
+            failed_histogram[i] += other.failed_histogram[i];
+        }
+
+        successful_lookups += other.successful_lookups;
+        successful_probes += other.successful_probes;
+        failed_lookups += other.failed_lookups;
+        failed_probes += other.failed_probes;
+        max_probes = std::max(max_probes, other.max_probes);
+
+        tombstones += other.tombstones;
+        rehash_count += other.rehash_count;
+        rehash_time += other.rehash_time;
+        allocated_bytes += other.allocated_bytes;
+
+        return *this;
+    }
+};
+
+// Stats policies. The tables report every lookup and time every rehash through the
+// policy; NoStats compiles all of it away, CollectStats counts into a TableStats.
+// Recording writes to the table, so a find that records is not a read-only operation.
+struct NoStats {
+    static constexpr bool enabled = false;
+
+    struct RehashTimer {
+        explicit RehashTimer(NoStats &) {}
+    };
+
+    inline void record_lookup(bool, std::size_t) {}
+
+    inline TableStats snapshot() const {
+        return {};
+    }
+};
+
+struct CollectStats {
+    static constexpr bool enabled = true;
+
+    class RehashTimer {
+    public:
+        explicit RehashTimer(CollectStats &stats) : stats(stats), start(std::chrono::steady_clock::now()) {}
+
+        RehashTimer(const RehashTimer &) = delete;
+
+        RehashTimer &operator=(const RehashTimer &) = delete;
+
+        ~RehashTimer() {
+            ++stats.counters.rehash_count;
+            stats.counters.rehash_time += std::chrono::steady_clock::now() - start;
+        }
+
+    private:
+        CollectStats &stats;
+        std::chrono::steady_clock::time_point start;
+    };
+
+    inline void record_lookup(bool found, std::size_t probes) {
+        std::size_t i = std::min(probes, TableStats::histogram_size - 1);
+
+        if (found) {
+            ++counters.successful_histogram[i];
+            ++counters.successful_lookups;
+            counters.successful_probes += probes;
+        } else {
+            ++counters.failed_histogram[i];
+            ++counters.failed_lookups;
+            counters.failed_probes += probes;
+        }
+
+        counters.max_probes = std::max(counters.max_probes, probes);
+    }
+
+    inline TableStats snapshot() const {
+        return counters;
+    }
+
+private:
+    TableStats counters;
+};
+
+#endif //UNTITLED3_STATS_H
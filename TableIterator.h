@@ -0,0 +1,101 @@
+#ifndef UNTITLED3_TABLEITERATOR_H
+#define UNTITLED3_TABLEITERATOR_H
+
+#include <cstddef>
+#include <algorithm>
+#include <iterator>
+#include <ranges>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Forward iterator over a table whose entries sit at numbered positions. The table gives
+// it friend access to next_full(i, end), the first full position in [i, end) or end, and
+// position_kv(i), the entry at a full position. An iterator walks [i, end), begin() and
+// end() of a table walk all of its positions. Inserts and removes invalidate iterators.
+template<typename Table, typename Value>
+class SlotIterator {
+    template<typename, typename> friend class SlotIterator;
+
+public:
+    using value_type = std::remove_const_t<Value>;
+    using difference_type = std::ptrdiff_t;
+    using reference = Value &;
+    using pointer = Value *;
+    using iterator_category = std::forward_iterator_tag;
+
+    SlotIterator() = default;
+
+    SlotIterator(Table *table, std::size_t i, std::size_t end) : table(table), i(table->next_full(i, end)), end(end) {}
+
+    // iterator to const_iterator
+    template<typename OtherTable, typename OtherValue>
+    requires std::is_convertible_v<OtherTable *, Table *> && std::is_convertible_v<OtherValue *, Value *>
+    SlotIterator(const SlotIterator<OtherTable, OtherValue> &other) : table(other.table), i(other.i), end(other.end) {}
+
+    reference operator*() const {
+        return table->position_kv(i);
+    }
+
+    pointer operator->() const {
+        return &table->position_kv(i);
+    }
+
+    SlotIterator &operator++() {
+        i = table->next_full(i + 1, end);
+        return *this;
+    }
+
+    SlotIterator operator++(int) {
+        SlotIterator result = *this;
+        ++*this;
+        return result;
+    }
+
+    bool operator==(const SlotIterator &other) const {
+        return i == other.i;
+    }
+
+private:
+    Table *table = nullptr;
+    std::size_t i = 0;
+    std::size_t end = 0;
+};
+
+// A table's size() is its capacity, fullness() the number of entries: tables declaring
+// capacity_sized are not taken for sized ranges by std::ranges::size and distance.
+template<typename T>
+concept CapacitySized = requires { typename T::capacity_sized; };
+
+template<CapacitySized T>
+inline constexpr bool std::ranges::disable_sized_range<T> = true;
+
+// fewer positions per thread are not worth starting it
+static constexpr std::size_t parallel_for_each_min_positions = std::size_t{1} << 14;
+
+// fn(kv) for every entry, positions [0, count) split evenly over threads which walk their
+// share with Iterator(table, begin, end). fn runs on several threads at once, the table
+// must not change meanwhile.
+template<typename Iterator, typename Table, typename F>
+void parallel_for_each_position(Table *table, std::size_t count, F &fn, std::size_t threads) {
+    threads = std::clamp<std::size_t>(threads, 1, std::max<std::size_t>(count / parallel_for_each_min_positions, 1));
+
+    auto walk = [&](std::size_t t) {
+        std::size_t begin = count * t / threads;
+        std::size_t end = count * (t + 1) / threads;
+
+        for (Iterator it(table, begin, end), last(table, end, end); it != last; ++it) {
+            fn(*it);
+        }
+    };
+
+    std::vector<std::jthread> workers;
+
+    for (std::size_t t = 1; t < threads; ++t) {
+        workers.emplace_back(walk, t);
+    }
+
+    walk(0);
+}
+
+#endif //UNTITLED3_TABLEITERATOR_H
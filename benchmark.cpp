@@ -0,0 +1,918 @@
+#include <iostream>
+#include "DoubleHashingHashTable.h"
+#include "LinearProbingHashTable.h"
+#include "BucketHashTable.h"
+#include "GroupProbingHashTable.h"
+#include "RobinHoodHashingHashTable.h"
+#include "CuckooHashTable.h"
+#include "NodePool.h"
+#include "HugePageAllocator.h"
+#include "ShardedHashTable.h"
+#include "ConcurrentLinearProbingHashTable.h"
+#include "ReadMostlyHashTable.h"
+#include "Hashers.h"
+#include <concepts>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+#include <ranges>
+#include <chrono>
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <numeric>
+#include <memory>
+#include <optional>
+#include <random>
+#include <span>
+#include <thread>
+#include <type_traits>
+#include <latch>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+
+// Benchmark of a single engine on a configurable workload, every option is given on the
+// command line (see usage below). The key universe holds 2 * size distinct keys, the
+// first size of them are inserted before the clock starts, so uniformly drawn finds hit
+// about half of the time and inserts and removes keep the fullness near size.
+//
+// Operations are generated up front and timed in batches, a sample is the average time of
+// one operation of a batch; the percentiles are taken over all samples of all threads and
+// repetitions. Every repetition starts from a fresh table and runs warmup operations first.
+//
+// --hash-quality measures the hashers instead of an engine, on keys of every type and
+// distribution: throughput, avalanche of single bit flips and spread over buckets.
+//
+// The huge- engines differ from their namesakes only by huge pages for the slot and bucket
+// arrays. Random finds over growing tables show what the TLB misses cost:
+//     for size in 1000000 10000000 100000000 500000000; do
+//         for engine in flat-linear huge-flat-linear interleaved-huge-flat-linear; do
+//             benchmark --engine $engine --size $size --mix 100,0,0 --format csv --no-header
+//         done
+//     done
+//
+// Reader scaling of the read-mostly engine against one std::shared_mutex around the same table:
+//     for threads in 1 2 4 8 16 32; do
+//         for engine in shared-mutex-flat-linear read-mostly-flat-linear; do
+//             benchmark --engine $engine --threads $threads --mix 100,0,0 --format csv --no-header
+//         done
+//     done
+
+template<typename K>
+struct StdHasher {
+    std::size_t operator()(const K &key) {
+        return std::hash<K>{}(key);
+    }
+};
+
+// std::hash has none for pairs, this is the usual stand-in
+template<>
+struct StdHasher<std::pair<std::uint64_t, bool>> {
+    std::size_t operator()(const std::pair<std::uint64_t, bool> &key) {
+        return std::hash<std::uint64_t>{}(key.first) ^ (std::hash<bool>{}(key.second) << 1);
+    }
+};
+
+template<typename K, typename V, template<typename> typename H, double load_factor_limit>
+using FlatLinearHashingHashTable = LinearHashingHashTable<K, V, H, load_factor_limit, FlatSlotStorage>;
+
+template<typename K, typename V, template<typename> typename H, double load_factor_limit>
+using PowerOfTwoLinearHashingHashTable = LinearHashingHashTable<K, V, H, load_factor_limit, FlatSlotStorage,
+        PowerOfTwoCapacity>;
+
+template<typename K, typename V, template<typename> typename H, double load_factor_limit>
+using FlatDoubleHashingHashTable = DoubleHashingHashTable<K, V, H, load_factor_limit, FlatSlotStorage>;
+
+template<typename K, typename V, template<typename> typename H, double load_factor_limit>
+using IncrementalBucketHashTable = BucketHashTable<K, V, H, load_factor_limit, PrimeCapacity, IncrementalResize<>>;
+
+template<typename K, typename V, template<typename> typename H, double load_factor_limit>
+using PoolBucketHashTable = BucketHashTable<K, V, H, load_factor_limit, PrimeCapacity, StopTheWorldResize,
+        PoolAllocator<std::pair<const K, V>>>;
+
+template<typename K, typename V, template<typename> typename H, double load_factor_limit>
+using PowerOfTwoGroupProbingHashTable = GroupProbingHashTable<K, V, H, load_factor_limit, PowerOfTwoCapacity>;
+
+template<typename K, typename V, template<typename> typename H, double load_factor_limit>
+using FlatRobinHoodHashingHashTable = RobinHoodHashingHashTable<K, V, H, load_factor_limit, FlatSlotStorage>;
+
+// slot and bucket arrays on huge pages, from hugetlbfs when its pool has them
+template<typename K, typename V, template<typename> typename H, double load_factor_limit>
+using HugeFlatLinearHashingHashTable = LinearHashingHashTable<K, V, H, load_factor_limit, FlatSlotStorage,
+        PrimeCapacity, HugePageAllocator<std::pair<const K, V>, NumaPlacement::first_touch, true>>;
+
+template<typename K, typename V, template<typename> typename H, double load_factor_limit>
+using InterleavedHugeFlatLinearHashingHashTable = LinearHashingHashTable<K, V, H, load_factor_limit, FlatSlotStorage,
+        PrimeCapacity, HugePageAllocator<std::pair<const K, V>, NumaPlacement::interleave, true>>;
+
+template<typename K, typename V, template<typename> typename H, double load_factor_limit>
+using HugeBucketHashTable = BucketHashTable<K, V, H, load_factor_limit, PrimeCapacity, StopTheWorldResize,
+        HugePageAllocator<std::pair<const K, V>, NumaPlacement::first_touch, true>>;
+
+template<typename K, typename V, template<typename> typename H, double load_factor_limit>
+using ShardedFlatLinearHashingHashTable = ShardedHashTable<FlatLinearHashingHashTable<K, V, H, load_factor_limit>>;
+
+template<typename K, typename V, template<typename> typename H, double load_factor_limit>
+using SharedMutexFlatLinearHashingHashTable = ShardedHashTable<FlatLinearHashingHashTable<K, V, H, load_factor_limit>, 1>;
+
+template<typename K, typename V, template<typename> typename H, double load_factor_limit>
+using ReadMostlyFlatLinearHashingHashTable = ReadMostlyHashTable<LinearHashingHashTable<K, V, H, load_factor_limit,
+        FlatSlotStorage, PrimeCapacity, EpochAllocator<std::pair<const K, V>>>>;
+
+enum class Operation : std::uint8_t {
+    find, insert, remove
+};
+
+struct Options {
+    std::string engine = "flat-linear";
+    std::string key_type = "u64";
+    std::string hasher = "std";
+    std::size_t size = 1'000'000;
+    double load_factor = 0.8;
+    std::string distribution = "uniform";
+    double zipf_theta = 0.99;
+    std::size_t find_percent = 90;
+    std::size_t insert_percent = 5;
+    std::size_t remove_percent = 5;
+    std::size_t threads = 1;
+    std::size_t operations = 4'000'000;
+    std::size_t warmup = 400'000;
+    std::size_t repetitions = 5;
+    std::size_t batch = 1024;
+    std::uint64_t seed = 1;
+    std::string format = "text";
+    bool header = true;
+    bool hash_quality = false;
+};
+
+struct Result {
+    std::vector<double> throughputs;
+    std::vector<double> samples;
+    std::size_t successes = 0;
+    std::size_t fullness = 0;
+};
+
+static constexpr std::string_view usage =
+        "usage: benchmark [options]\n"
+        "  --engine NAME         linear, flat-linear, pow2-linear, double, flat-double, bucket,\n"
+        "                        incremental-bucket, pool-bucket, group, pow2-group, robin-hood,\n"
+        "                        flat-robin-hood, cuckoo, sharded-flat-linear, concurrent-linear,\n"
+        "                        huge-flat-linear, interleaved-huge-flat-linear, huge-bucket,\n"
+        "                        shared-mutex-flat-linear, read-mostly-flat-linear\n"
+        "  --key TYPE            u64 or string\n"
+        "  --hasher NAME         std or fast (see Hashers.h)\n"
+        "  --size N              entries inserted before measuring\n"
+        "  --load-factor LF      load factor limit: 0.5, 0.7, 0.8 or 0.9\n"
+        "  --distribution NAME   uniform, zipfian, sequential or adversarial\n"
+        "  --zipf-theta T        skew of the zipfian distribution\n"
+        "  --mix F,I,R           percents of finds, inserts and removes\n"
+        "  --threads N           more than one only for sharded, shared-mutex, read-mostly and\n"
+        "                        concurrent engines\n"
+        "  --operations N        timed operations per repetition over all threads\n"
+        "  --warmup N            untimed operations per repetition\n"
+        "  --repetitions N\n"
+        "  --batch N             operations per timing sample\n"
+        "  --seed N\n"
+        "  --format NAME         text, json or csv\n"
+        "  --no-header           csv without the header line, for appending\n"
+        "  --hash-quality        measure the hashers on u64, string and pair keys of the uniform,\n"
+        "                        sequential and adversarial distributions instead of an engine\n";
+
+std::optional<Options> parse_options(int argc, char **argv) {
+    Options options;
+    std::map<std::string_view, std::string_view> values;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string_view name = argv[i];
+
+        if (name == "--help") {
+            return {};
+        }
+
+        if (name == "--no-header") {
+            options.header = false;
+        } else if (name == "--hash-quality") {
+            options.hash_quality = true;
+        } else if (name.starts_with("--") && i + 1 < argc) {
+            values[name.substr(2)] = argv[++i];
+        } else {
+            std::cerr << "unknown argument: " << name << "\n";
+            return {};
+        }
+    }
+
+    auto number = [&](std::string_view name, auto &target) {
+        if (auto it = values.find(name); it != values.end()) {
+            std::istringstream(std::string(it->second)) >> target;
+            values.erase(it);
+        }
+    };
+
+    auto text = [&](std::string_view name, std::string &target) {
+        if (auto it = values.find(name); it != values.end()) {
+            target = it->second;
+            values.erase(it);
+        }
+    };
+
+    text("engine", options.engine);
+    text("key", options.key_type);
+    text("hasher", options.hasher);
+    number("size", options.size);
+    number("load-factor", options.load_factor);
+    text("distribution", options.distribution);
+    number("zipf-theta", options.zipf_theta);
+    number("threads", options.threads);
+    number("operations", options.operations);
+    number("warmup", options.warmup);
+    number("repetitions", options.repetitions);
+    number("batch", options.batch);
+    number("seed", options.seed);
+    text("format", options.format);
+
+    if (auto it = values.find("mix"); it != values.end()) {
+        char comma;
+        std::istringstream(std::string(it->second)) >> options.find_percent >> comma >> options.insert_percent >>
+                                                    comma >> options.remove_percent;
+        values.erase(it);
+    }
+
+    if (!values.empty()) {
+        std::cerr << "unknown option: --" << values.begin()->first << "\n";
+        return {};
+    }
+
+    if (options.find_percent + options.insert_percent + options.remove_percent != 100) {
+        std::cerr << "the mix must add up to 100\n";
+        return {};
+    }
+
+    if (options.size == 0 || options.threads == 0 || options.batch == 0 || options.repetitions == 0) {
+        std::cerr << "size, threads, batch and repetitions must be positive\n";
+        return {};
+    }
+
+    // threads pinning the table take a slot of max_thread_slots each, one is left for the main thread
+    if ((options.engine == "concurrent-linear" || options.engine == "read-mostly-flat-linear") &&
+        options.threads >= max_thread_slots) {
+        std::cerr << options.engine << " takes at most " << max_thread_slots - 1 << " threads\n";
+        return {};
+    }
+
+    return options;
+}
+
+// 2 * size distinct keys. Adversarial keys share their low 32 bits, tables that take the
+// home slot from the low bits of an identity hash put all of them into one probe sequence.
+std::vector<std::uint64_t> generate_universe(const Options &options) {
+    std::size_t count = 2 * options.size;
+    std::vector<std::uint64_t> universe(count);
+
+    if (options.distribution == "sequential") {
+        std::iota(universe.begin(), universe.end(), std::uint64_t{0});
+    } else if (options.distribution == "adversarial") {
+        for (std::size_t i = 0; i < count; ++i) {
+            universe[i] = static_cast<std::uint64_t>(i + 1) << 32;
+        }
+    } else {
+        std::mt19937_64 random(options.seed);
+        std::unordered_set<std::uint64_t> unique_keys;
+        unique_keys.reserve(count);
+
+        for (std::size_t i = 0; i < count;) {
+            std::uint64_t key = random() >> 1;
+
+            if (unique_keys.insert(key).second) {
+                universe[i++] = key;
+            }
+        }
+    }
+
+    return universe;
+}
+
+// draws indices into the universe: zipfian ranks are spread over the universe by a fixed
+// permutation, so the hottest keys are not simply the ones inserted first
+class KeyChooser {
+public:
+    KeyChooser(const Options &options, std::size_t count) : distribution(options.distribution), count(count) {
+        if (distribution != "zipfian") {
+            return;
+        }
+
+        cumulative.resize(count);
+        double sum = 0;
+
+        for (std::size_t i = 0; i < count; ++i) {
+            sum += 1. / std::pow(static_cast<double>(i + 1), options.zipf_theta);
+            cumulative[i] = sum;
+        }
+
+        for (double &value: cumulative) {
+            value /= sum;
+        }
+
+        ranks.resize(count);
+        std::iota(ranks.begin(), ranks.end(), std::size_t{0});
+        std::shuffle(ranks.begin(), ranks.end(), std::mt19937_64(options.seed + 1));
+    }
+
+    template<typename Random>
+    std::size_t choose(Random &random, std::size_t position) const {
+        if (distribution == "sequential") {
+            return position % count;
+        }
+
+        if (distribution == "zipfian") {
+            double u = std::uniform_real_distribution<double>(0., 1.)(random);
+            auto rank = std::lower_bound(cumulative.begin(), cumulative.end(), u) - cumulative.begin();
+            return ranks[std::min(static_cast<std::size_t>(rank), count - 1)];
+        }
+
+        return random() % count;
+    }
+
+private:
+    std::string distribution;
+    std::size_t count;
+    std::vector<double> cumulative;
+    std::vector<std::size_t> ranks;
+};
+
+struct Step {
+    Operation operation;
+    std::uint32_t key_index;
+};
+
+std::vector<Step> generate_steps(const Options &options, const KeyChooser &chooser, std::size_t count,
+                                 std::uint64_t seed, std::size_t first_position) {
+    std::mt19937_64 random(seed);
+    std::vector<Step> steps(count);
+
+    for (std::size_t i = 0; i < count; ++i) {
+        std::size_t roll = random() % 100;
+        Operation operation = roll < options.find_percent ? Operation::find :
+                              roll < options.find_percent + options.insert_percent ? Operation::insert
+                                                                                  : Operation::remove;
+
+        steps[i] = {operation, static_cast<std::uint32_t>(chooser.choose(random, first_position + i))};
+    }
+
+    return steps;
+}
+
+template<typename Table, typename K>
+inline bool apply(Table &table, const Step &step, const std::vector<K> &keys) {
+    const K &key = keys[step.key_index];
+
+    switch (step.operation) {
+        case Operation::find:
+            if constexpr (requires { table.contains(key); }) {
+                return table.contains(key);
+            } else {
+                return table.find(key).has_value();
+            }
+        case Operation::insert:
+            return table.insert({key, step.key_index});
+        case Operation::remove:
+            return table.remove(key).has_value();
+    }
+
+    return false;
+}
+
+template<typename Table, typename K>
+Result run(const Options &options, const std::vector<K> &keys) {
+    KeyChooser chooser(options, keys.size());
+    Result result;
+
+    std::size_t per_thread = options.operations / options.threads;
+    std::size_t warmup_per_thread = options.warmup / options.threads;
+
+    for (std::size_t repetition = 0; repetition < options.repetitions; ++repetition) {
+        auto table = std::make_unique<Table>();
+
+        for (std::size_t i = 0; i < options.size; ++i) {
+            table->insert({keys[i], i});
+        }
+
+        std::vector<std::vector<Step>> warmups;
+        std::vector<std::vector<Step>> steps;
+
+        for (std::size_t t = 0; t < options.threads; ++t) {
+            std::uint64_t seed = options.seed + 1000 * repetition + 2 * t;
+            std::size_t first_position = t * keys.size() / options.threads;
+
+            warmups.push_back(generate_steps(options, chooser, warmup_per_thread, seed, first_position));
+            steps.push_back(generate_steps(options, chooser, per_thread, seed + 1,
+                                           first_position + warmup_per_thread));
+        }
+
+        std::vector<std::vector<double>> samples(options.threads);
+        std::vector<std::size_t> successes(options.threads);
+        std::latch warmed_up(static_cast<std::ptrdiff_t>(options.threads) + 1);
+        std::latch start(static_cast<std::ptrdiff_t>(options.threads) + 1);
+        std::vector<std::jthread> threads;
+
+        for (std::size_t t = 0; t < options.threads; ++t) {
+            threads.emplace_back([&, t] {
+                for (const Step &step: warmups[t]) {
+                    apply(*table, step, keys);
+                }
+
+                warmed_up.arrive_and_wait();
+                start.arrive_and_wait();
+
+                for (std::size_t begin = 0; begin < steps[t].size(); begin += options.batch) {
+                    std::size_t end = std::min(steps[t].size(), begin + options.batch);
+
+                    auto t1 = std::chrono::steady_clock::now();
+                    for (std::size_t i = begin; i < end; ++i) {
+                        successes[t] += apply(*table, steps[t][i], keys);
+                    }
+                    auto t2 = std::chrono::steady_clock::now();
+
+                    std::chrono::duration<double, std::nano> duration = t2 - t1;
+                    samples[t].push_back(duration.count() / static_cast<double>(end - begin));
+                }
+            });
+        }
+
+        warmed_up.arrive_and_wait();
+
+        auto t1 = std::chrono::steady_clock::now();
+        start.arrive_and_wait();
+        threads.clear();
+        auto t2 = std::chrono::steady_clock::now();
+
+        std::chrono::duration<double, std::micro> duration = t2 - t1;
+        result.throughputs.push_back(static_cast<double>(per_thread * options.threads) / duration.count());
+
+        for (auto &thread_samples: samples) {
+            result.samples.insert(result.samples.end(), thread_samples.begin(), thread_samples.end());
+        }
+
+        result.successes = std::accumulate(successes.begin(), successes.end(), std::size_t{0});
+        result.fullness = table->fullness();
+    }
+
+    return result;
+}
+
+double percentile(const std::vector<double> &sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+
+    auto i = static_cast<std::size_t>(p * static_cast<double>(sorted.size() - 1) + 0.5);
+    return sorted[i];
+}
+
+using Fields = std::vector<std::pair<std::string_view, std::string>>;
+
+// a record in the chosen format, the quoted fields are json strings; csv records start
+// with the header line when header is set
+void print_record(const Options &options, const Fields &fields, std::span<const std::string_view> quoted_fields,
+                  bool header) {
+    auto quoted = [&](std::size_t i) {
+        return std::ranges::find(quoted_fields, fields[i].first) != quoted_fields.end();
+    };
+
+    if (options.format == "json") {
+        std::cout << "{";
+        for (std::size_t i = 0; i < fields.size(); ++i) {
+            std::cout << (i ? ", " : "") << "\"" << fields[i].first << "\": ";
+            std::cout << (quoted(i) ? "\"" : "") << fields[i].second << (quoted(i) ? "\"" : "");
+        }
+        std::cout << "}\n";
+    } else if (options.format == "csv") {
+        if (header) {
+            for (std::size_t i = 0; i < fields.size(); ++i) {
+                std::cout << (i ? "," : "") << fields[i].first;
+            }
+            std::cout << "\n";
+        }
+
+        for (std::size_t i = 0; i < fields.size(); ++i) {
+            std::cout << (i ? "," : "") << fields[i].second;
+        }
+        std::cout << "\n";
+    } else {
+        for (auto &[name, value]: fields) {
+            std::cout << name << ": " << value << "\n";
+        }
+    }
+}
+
+void report(const Options &options, Result &result) {
+    std::sort(result.samples.begin(), result.samples.end());
+    std::sort(result.throughputs.begin(), result.throughputs.end());
+
+    double mean = result.samples.empty() ? 0 :
+                  std::accumulate(result.samples.begin(), result.samples.end(), 0.) /
+                  static_cast<double>(result.samples.size());
+
+    std::ostringstream mix;
+    mix << options.find_percent << "/" << options.insert_percent << "/" << options.remove_percent;
+
+    Fields fields{
+            {"engine",              options.engine},
+            {"key",                 options.key_type},
+            {"hasher",              options.hasher},
+            {"size",                std::to_string(options.size)},
+            {"load_factor_limit",   std::to_string(options.load_factor)},
+            {"distribution",        options.distribution},
+            {"mix",                 mix.str()},
+            {"threads",             std::to_string(options.threads)},
+            {"operations",          std::to_string(options.operations)},
+            {"repetitions",         std::to_string(options.repetitions)},
+            {"batch",               std::to_string(options.batch)},
+            {"successes",           std::to_string(result.successes)},
+            {"fullness",            std::to_string(result.fullness)},
+            {"throughput_mops_median", std::to_string(percentile(result.throughputs, 0.5))},
+            {"throughput_mops_min", std::to_string(result.throughputs.front())},
+            {"throughput_mops_max", std::to_string(result.throughputs.back())},
+            {"latency_ns_mean",     std::to_string(mean)},
+            {"latency_ns_p50",      std::to_string(percentile(result.samples, 0.5))},
+            {"latency_ns_p90",      std::to_string(percentile(result.samples, 0.9))},
+            {"latency_ns_p99",      std::to_string(percentile(result.samples, 0.99))},
+            {"latency_ns_p999",     std::to_string(percentile(result.samples, 0.999))},
+            {"latency_ns_max",      std::to_string(percentile(result.samples, 1.))},
+    };
+
+    std::array<std::string_view, 5> quoted{"engine", "key", "hasher", "distribution", "mix"};
+    print_record(options, fields, quoted, options.header);
+}
+
+template<typename K, template<typename, typename, template<typename> typename, double> typename H,
+        template<typename> typename Hasher>
+std::optional<Result> run_with_load_factor(const Options &options, const std::vector<K> &keys) {
+    if (options.load_factor == 0.5) {
+        return run<H<K, std::size_t, Hasher, 0.5>>(options, keys);
+    }
+
+    if (options.load_factor == 0.7) {
+        return run<H<K, std::size_t, Hasher, 0.7>>(options, keys);
+    }
+
+    if (options.load_factor == 0.8) {
+        return run<H<K, std::size_t, Hasher, 0.8>>(options, keys);
+    }
+
+    if (options.load_factor == 0.9) {
+        return run<H<K, std::size_t, Hasher, 0.9>>(options, keys);
+    }
+
+    std::cerr << "unsupported load factor limit: " << options.load_factor << "\n";
+    return {};
+}
+
+template<typename K, template<typename> typename Hasher>
+std::optional<Result> run_engine(const Options &options, const std::vector<K> &keys) {
+    const std::string &engine = options.engine;
+
+    if (options.threads > 1 && engine != "sharded-flat-linear" && engine != "shared-mutex-flat-linear" &&
+        engine != "read-mostly-flat-linear" && engine != "concurrent-linear") {
+        std::cerr << engine << " is not thread-safe\n";
+        return {};
+    }
+
+    if (engine == "linear") {
+        return run_with_load_factor<K, LinearHashingHashTable, Hasher>(options, keys);
+    }
+
+    if (engine == "flat-linear") {
+        return run_with_load_factor<K, FlatLinearHashingHashTable, Hasher>(options, keys);
+    }
+
+    if (engine == "huge-flat-linear") {
+        return run_with_load_factor<K, HugeFlatLinearHashingHashTable, Hasher>(options, keys);
+    }
+
+    if (engine == "interleaved-huge-flat-linear") {
+        return run_with_load_factor<K, InterleavedHugeFlatLinearHashingHashTable, Hasher>(options, keys);
+    }
+
+    if (engine == "pow2-linear") {
+        return run_with_load_factor<K, PowerOfTwoLinearHashingHashTable, Hasher>(options, keys);
+    }
+
+    if (engine == "double") {
+        return run_with_load_factor<K, DoubleHashingHashTable, Hasher>(options, keys);
+    }
+
+    if (engine == "flat-double") {
+        return run_with_load_factor<K, FlatDoubleHashingHashTable, Hasher>(options, keys);
+    }
+
+    if (engine == "bucket") {
+        return run_with_load_factor<K, BucketHashTable, Hasher>(options, keys);
+    }
+
+    if (engine == "incremental-bucket") {
+        return run_with_load_factor<K, IncrementalBucketHashTable, Hasher>(options, keys);
+    }
+
+    if (engine == "pool-bucket") {
+        return run_with_load_factor<K, PoolBucketHashTable, Hasher>(options, keys);
+    }
+
+    if (engine == "huge-bucket") {
+        return run_with_load_factor<K, HugeBucketHashTable, Hasher>(options, keys);
+    }
+
+    if (engine == "group") {
+        return run_with_load_factor<K, GroupProbingHashTable, Hasher>(options, keys);
+    }
+
+    if (engine == "pow2-group") {
+        return run_with_load_factor<K, PowerOfTwoGroupProbingHashTable, Hasher>(options, keys);
+    }
+
+    if (engine == "robin-hood") {
+        return run_with_load_factor<K, RobinHoodHashingHashTable, Hasher>(options, keys);
+    }
+
+    if (engine == "flat-robin-hood") {
+        return run_with_load_factor<K, FlatRobinHoodHashingHashTable, Hasher>(options, keys);
+    }
+
+    if (engine == "cuckoo") {
+        return run_with_load_factor<K, CuckooHashTable, Hasher>(options, keys);
+    }
+
+    if (engine == "sharded-flat-linear") {
+        return run_with_load_factor<K, ShardedFlatLinearHashingHashTable, Hasher>(options, keys);
+    }
+
+    if (engine == "shared-mutex-flat-linear") {
+        return run_with_load_factor<K, SharedMutexFlatLinearHashingHashTable, Hasher>(options, keys);
+    }
+
+    if (engine == "read-mostly-flat-linear") {
+        if constexpr (std::is_trivially_copyable_v<K>) {
+            return run_with_load_factor<K, ReadMostlyFlatLinearHashingHashTable, Hasher>(options, keys);
+        }
+
+        std::cerr << "read-mostly-flat-linear only takes trivially copyable keys\n";
+        return {};
+    }
+
+    if (engine == "concurrent-linear") {
+        if constexpr (std::integral<K>) {
+            return run_with_load_factor<K, ConcurrentLinearHashingHashTable, Hasher>(options, keys);
+        }
+
+        std::cerr << "concurrent-linear only takes integral keys\n";
+        return {};
+    }
+
+    std::cerr << "unknown engine: " << engine << "\n";
+    return {};
+}
+
+template<typename K>
+std::optional<Result> run_with_hasher(const Options &options, const std::vector<K> &keys) {
+    if (options.hasher == "std") {
+        return run_engine<K, StdHasher>(options, keys);
+    }
+
+    if (options.hasher == "fast") {
+        return run_engine<K, FastHasher>(options, keys);
+    }
+
+    std::cerr << "unknown hasher: " << options.hasher << "\n";
+    return {};
+}
+
+std::vector<std::string> string_keys(const std::vector<std::uint64_t> &universe) {
+    std::vector<std::string> keys;
+    keys.reserve(universe.size());
+
+    for (std::uint64_t key: universe) {
+        keys.push_back("benchmark key " + std::to_string(key));
+    }
+
+    return keys;
+}
+
+// every key of the first half of the universe with both values of the flag
+std::vector<std::pair<std::uint64_t, bool>> pair_keys(const std::vector<std::uint64_t> &universe) {
+    std::vector<std::pair<std::uint64_t, bool>> keys;
+    keys.reserve(universe.size());
+
+    for (std::size_t i = 0; i < universe.size(); ++i) {
+        keys.emplace_back(universe[i / 2], i % 2 != 0);
+    }
+
+    return keys;
+}
+
+// the bits of a key the avalanche test flips one at a time: of strings the last eight
+// bytes, where the benchmark keys differ
+std::size_t key_bits(std::uint64_t) {
+    return 64;
+}
+
+std::size_t key_bits(const std::string &key) {
+    return 8 * std::min<std::size_t>(key.size(), 8);
+}
+
+std::size_t key_bits(const std::pair<std::uint64_t, bool> &) {
+    return 65;
+}
+
+std::uint64_t flip_bit(std::uint64_t key, std::size_t bit) {
+    return key ^ (std::uint64_t{1} << bit);
+}
+
+std::string flip_bit(std::string key, std::size_t bit) {
+    key[key.size() - 1 - bit / 8] ^= static_cast<char>(1 << bit % 8);
+    return key;
+}
+
+std::pair<std::uint64_t, bool> flip_bit(std::pair<std::uint64_t, bool> key, std::size_t bit) {
+    return bit < 64 ? std::pair(flip_bit(key.first, bit), key.second) : std::pair(key.first, !key.second);
+}
+
+struct HashQuality {
+    double throughput_mhashes = 0;
+
+    // |2 p - 1| for the probability p that an output bit changes with an input bit, 0 at best
+    double avalanche_bias_mean = 0;
+    double avalanche_bias_max = 0;
+
+    // chi-square over 2^16 buckets divided by its degrees of freedom, about 1 for a random
+    // function: the low bits pick the bucket as for PowerOfTwoCapacity, then the high bits
+    double low_bits_chi2 = 0;
+    double high_bits_chi2 = 0;
+    std::size_t low_bits_max_load = 0;
+};
+
+// keeps the timed hashes from being optimized away
+volatile std::uint64_t hash_sink;
+
+template<template<typename> typename Hasher, typename K>
+HashQuality measure_hash_quality(const std::vector<K> &keys) {
+    Hasher<K> hash;
+    HashQuality quality;
+
+    double best_us = std::numeric_limits<double>::infinity();
+
+    for (std::size_t pass = 0; pass < 5; ++pass) {
+        std::uint64_t sum = 0;
+
+        auto t1 = std::chrono::steady_clock::now();
+        for (const K &key: keys) {
+            sum += hash(key);
+        }
+        auto t2 = std::chrono::steady_clock::now();
+
+        hash_sink = sum;
+        best_us = std::min(best_us, std::chrono::duration<double, std::micro>(t2 - t1).count());
+    }
+
+    quality.throughput_mhashes = static_cast<double>(keys.size()) / best_us;
+
+    std::size_t samples = std::min<std::size_t>(keys.size(), 4096);
+    std::size_t bits = std::numeric_limits<std::size_t>::max();
+
+    for (std::size_t i = 0; i < samples; ++i) {
+        bits = std::min(bits, key_bits(keys[i]));
+    }
+
+    std::vector<std::size_t> flips(bits * 64);
+
+    for (std::size_t i = 0; i < samples; ++i) {
+        std::uint64_t h = hash(keys[i]);
+
+        for (std::size_t bit = 0; bit < bits; ++bit) {
+            std::uint64_t difference = h ^ static_cast<std::uint64_t>(hash(flip_bit(keys[i], bit)));
+
+            for (std::size_t out = 0; out < 64; ++out) {
+                flips[bit * 64 + out] += difference >> out & 1;
+            }
+        }
+    }
+
+    for (std::size_t count: flips) {
+        double bias = std::abs(2. * static_cast<double>(count) / static_cast<double>(samples) - 1.);
+        quality.avalanche_bias_mean += bias / static_cast<double>(flips.size());
+        quality.avalanche_bias_max = std::max(quality.avalanche_bias_max, bias);
+    }
+
+    constexpr std::size_t bucket_bits = 16;
+    std::vector<std::size_t> low(std::size_t{1} << bucket_bits);
+    std::vector<std::size_t> high(std::size_t{1} << bucket_bits);
+
+    for (const K &key: keys) {
+        std::uint64_t h = hash(key);
+        ++low[h & (low.size() - 1)];
+        ++high[h >> (64 - bucket_bits)];
+    }
+
+    auto chi2 = [&](const std::vector<std::size_t> &buckets) {
+        double expected = static_cast<double>(keys.size()) / static_cast<double>(buckets.size());
+        double sum = 0;
+
+        for (std::size_t count: buckets) {
+            sum += (static_cast<double>(count) - expected) * (static_cast<double>(count) - expected) / expected;
+        }
+
+        return sum / static_cast<double>(buckets.size() - 1);
+    };
+
+    quality.low_bits_chi2 = chi2(low);
+    quality.high_bits_chi2 = chi2(high);
+    quality.low_bits_max_load = *std::max_element(low.begin(), low.end());
+
+    return quality;
+}
+
+// every hasher on every key type of the uniform, sequential and adversarial universes
+void run_hash_quality(const Options &options) {
+    bool header = options.header;
+
+    for (std::string_view distribution: {"uniform", "sequential", "adversarial"}) {
+        Options universe_options = options;
+        universe_options.distribution = distribution;
+
+        auto universe = generate_universe(universe_options);
+        auto strings = string_keys(universe);
+        auto pairs = pair_keys(universe);
+
+        auto print = [&](std::string_view hasher, std::string_view key, const HashQuality &quality) {
+            Fields fields{
+                    {"hasher",              std::string(hasher)},
+                    {"key",                 std::string(key)},
+                    {"distribution",        std::string(distribution)},
+                    {"keys",                std::to_string(universe.size())},
+                    {"throughput_mhashes",  std::to_string(quality.throughput_mhashes)},
+                    {"avalanche_bias_mean", std::to_string(quality.avalanche_bias_mean)},
+                    {"avalanche_bias_max",  std::to_string(quality.avalanche_bias_max)},
+                    {"low_bits_chi2",       std::to_string(quality.low_bits_chi2)},
+                    {"high_bits_chi2",      std::to_string(quality.high_bits_chi2)},
+                    {"low_bits_max_load",   std::to_string(quality.low_bits_max_load)},
+            };
+
+            std::array<std::string_view, 3> quoted{"hasher", "key", "distribution"};
+            print_record(options, fields, quoted, header);
+            header = false;
+
+            if (options.format == "text") {
+                std::cout << "\n";
+            }
+        };
+
+        print("std", "u64", measure_hash_quality<StdHasher>(universe));
+        print("fast", "u64", measure_hash_quality<FastHasher>(universe));
+        print("std", "string", measure_hash_quality<StdHasher>(strings));
+        print("fast", "string", measure_hash_quality<FastHasher>(strings));
+        print("std", "pair", measure_hash_quality<StdHasher>(pairs));
+        print("fast", "pair", measure_hash_quality<FastHasher>(pairs));
+    }
+}
+
+int main(int argc, char **argv) {
+    auto options = parse_options(argc, argv);
+
+    if (!options) {
+        std::cerr << usage;
+        return 1;
+    }
+
+    if (options->distribution != "uniform" && options->distribution != "zipfian" &&
+        options->distribution != "sequential" && options->distribution != "adversarial") {
+        std::cerr << "unknown distribution: " << options->distribution << "\n" << usage;
+        return 1;
+    }
+
+    if (options->hash_quality) {
+        run_hash_quality(*options);
+        return 0;
+    }
+
+    auto universe = generate_universe(*options);
+    std::optional<Result> result;
+
+    if (options->key_type == "u64") {
+        result = run_with_hasher(*options, universe);
+    } else if (options->key_type == "string") {
+        result = run_with_hasher(*options, string_keys(universe));
+    } else {
+        std::cerr << "unknown key type: " << options->key_type << "\n" << usage;
+        return 1;
+    }
+
+    if (!result) {
+        return 1;
+    }
+
+    report(*options, *result);
+    return 0;
+}
@@ -2,12 +2,33 @@
 #include "DoubleHashingHashTable.h"
 #include "LinearProbingHashTable.h"
 #include "BucketHashTable.h"
+#include "GroupProbingHashTable.h"
+#include "RobinHoodHashingHashTable.h"
+#include "CuckooHashTable.h"
+#include "NodePool.h"
+#include "ShardedHashTable.h"
+#include "ConcurrentLinearProbingHashTable.h"
+#include "ReadMostlyHashTable.h"
+#include "Hashers.h"
 #include <concepts>
 #include <cassert>
 #include <unordered_set>
 #include <vector>
 #include <ranges>
 #include <chrono>
+#include <algorithm>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <span>
+#include <thread>
+#include <latch>
+#include <atomic>
+#include <cstdlib>
+#include <filesystem>
+#include <new>
+#include <string>
+#include <string_view>
 
 template<std::integral T>
 consteval std::size_t bin_digits_amount(T number) {
@@ -60,10 +81,105 @@ struct StdHasher {
 template<>
 struct StdHasher<std::pair<std::size_t, bool>> {
     std::size_t operator()(const std::pair<std::size_t, bool> &key) {
-        return std::hash<std::size_t>{}(key.first) ^ (std::hash<bool>{}(key.second) << 1);
+        return hash_combine(std::hash<std::size_t>{}(key.first), std::hash<bool>{}(key.second));
     }
 };
 
+// hashes std::string keys through std::string_view, so tables also find them by views
+// and string literals without building a std::string first
+template<typename K>
+struct TransparentStringHasher {
+    using is_transparent = void;
+
+    std::size_t operator()(std::string_view key) {
+        return std::hash<std::string_view>{}(key);
+    }
+};
+
+// a string key that counts how often it is copied, moves are free
+struct CountedKey {
+    explicit CountedKey(std::string value) : value(std::move(value)) {}
+
+    CountedKey(const CountedKey &other) : value(other.value) {
+        ++copies;
+    }
+
+    CountedKey(CountedKey &&other) noexcept = default;
+
+    CountedKey &operator=(const CountedKey &other) {
+        value = other.value;
+        ++copies;
+        return *this;
+    }
+
+    CountedKey &operator=(CountedKey &&other) noexcept = default;
+
+    bool operator==(const CountedKey &other) const {
+        return value == other.value;
+    }
+
+    std::string value;
+
+    static inline std::size_t copies = 0;
+};
+
+template<>
+struct StdHasher<CountedKey> {
+    std::size_t operator()(const CountedKey &key) {
+        return std::hash<std::string>{}(key.value);
+    }
+};
+
+// every allocation of the program is counted, test_string_lookup reports the difference
+std::atomic<std::size_t> allocations_count = 0;
+
+void *operator new(std::size_t size) {
+    allocations_count.fetch_add(1, std::memory_order_relaxed);
+
+    if (void *p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept {
+    std::free(p);
+}
+
+template<typename K, typename V, template<typename> typename H, double load_factor_limit>
+using FlatLinearHashingHashTable = LinearHashingHashTable<K, V, H, load_factor_limit, FlatSlotStorage>;
+
+template<typename K, typename V, template<typename> typename H, double load_factor_limit>
+using IncrementalBucketHashTable = BucketHashTable<K, V, H, load_factor_limit, PrimeCapacity, IncrementalResize<>>;
+
+template<typename K, typename V, template<typename> typename H, double load_factor_limit>
+using PoolBucketHashTable = BucketHashTable<K, V, H, load_factor_limit, PrimeCapacity, StopTheWorldResize,
+        PoolAllocator<std::pair<const K, V>>>;
+
+template<typename K, typename V, template<typename> typename H, double load_factor_limit>
+using PoolLinearHashingHashTable = LinearHashingHashTable<K, V, H, load_factor_limit, NodeSlotStorage, PrimeCapacity,
+        PoolAllocator<std::pair<const K, V>>>;
+
+template<typename K, typename V, template<typename> typename H, double load_factor_limit>
+using PoolDoubleHashingHashTable = DoubleHashingHashTable<K, V, H, load_factor_limit, NodeSlotStorage, PrimeCapacity,
+        PoolAllocator<std::pair<const K, V>>>;
+
+template<typename K, typename V, template<typename> typename H, double load_factor_limit>
+using FlatDoubleHashingHashTable = DoubleHashingHashTable<K, V, H, load_factor_limit, FlatSlotStorage>;
+
+template<typename K, typename V, template<typename> typename H, double load_factor_limit>
+using ReadMostlyFlatLinearHashingHashTable = ReadMostlyHashTable<LinearHashingHashTable<K, V, H, load_factor_limit,
+        FlatSlotStorage, PrimeCapacity, EpochAllocator<std::pair<const K, V>>>>;
+
+template<typename K, typename V, template<typename> typename H, double load_factor_limit>
+using ReadMostlyBucketHashTable = ReadMostlyHashTable<BucketHashTable<K, V, H, load_factor_limit, PrimeCapacity,
+        StopTheWorldResize, EpochAllocator<std::pair<const K, V>>>>;
+
 std::ostream &bold_on(std::ostream &os) {
     return os << "\e[1m";
 }
@@ -191,6 +307,727 @@ void test_series(std::string_view title, std::unordered_set<std::size_t> random_
     test<H, min, 0.9, count_average_probes>(title, random_numbers);
 }
 
+template<template<typename, typename, template<typename> typename, double> typename H>
+void test_insert_latency(std::string_view title, std::size_t count) {
+    H<std::size_t, std::size_t, StdHasher, 0.8> hash_table;
+    std::vector<std::chrono::duration<double, std::micro>> latencies;
+    latencies.reserve(count);
+
+    for (std::size_t i = 0; i < count; ++i) {
+        auto t1 = std::chrono::high_resolution_clock::now();
+        hash_table.insert({i, i});
+        auto t2 = std::chrono::high_resolution_clock::now();
+
+        latencies.push_back(t2 - t1);
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+
+    auto percentile = [&latencies](double p) {
+        return latencies[static_cast<std::size_t>(p * static_cast<double>(latencies.size() - 1))].count();
+    };
+
+    std::cout << bold_on << "test: " << bold_off << title << "\n";
+    std::cout << bold_on << "inserts: " << bold_off << count << "\n";
+    std::cout << bold_on << "p50 insert latency: " << bold_off << percentile(0.5) << "us" << "\n";
+    std::cout << bold_on << "p90 insert latency: " << bold_off << percentile(0.9) << "us" << "\n";
+    std::cout << bold_on << "p99 insert latency: " << bold_off << percentile(0.99) << "us" << "\n";
+    std::cout << bold_on << "p99.9 insert latency: " << bold_off << percentile(0.999) << "us" << "\n";
+    std::cout << bold_on << "max insert latency: " << bold_off << latencies.back().count() << "us" << "\n\n";
+    std::cout << std::endl;
+}
+
+template<template<typename, typename, template<typename> typename, double> typename H>
+void test_find_batch(std::string_view title, const std::unordered_set<std::size_t> &random_numbers,
+                     std::size_t batch_size) {
+    H<std::size_t, std::size_t, StdHasher, 0.8> hash_table;
+
+    for (auto number: random_numbers) {
+        hash_table.insert({number, number});
+    }
+
+    std::vector<std::size_t> keys(random_numbers.begin(), random_numbers.end());
+    std::shuffle(keys.begin(), keys.end(), std::mt19937_64{});
+
+    std::size_t serial_probes_count = 0;
+    std::size_t serial_found_count = 0;
+
+    auto t1 = std::chrono::high_resolution_clock::now();
+    for (auto key: keys) {
+        serial_found_count += hash_table.find(key, serial_probes_count).has_value();
+    }
+    auto t2 = std::chrono::high_resolution_clock::now();
+
+    std::size_t batch_probes_count = 0;
+    std::size_t batch_found_count = 0;
+    std::vector<std::optional<std::reference_wrapper<std::pair<const std::size_t, std::size_t>>>> results;
+
+    auto t3 = std::chrono::high_resolution_clock::now();
+    for (std::size_t begin = 0; begin < keys.size(); begin += batch_size) {
+        std::span<const std::size_t> batch(keys.data() + begin, std::min(batch_size, keys.size() - begin));
+        hash_table.find_batch(batch, results, batch_probes_count);
+
+        for (const auto &result: results) {
+            batch_found_count += result.has_value();
+        }
+    }
+    auto t4 = std::chrono::high_resolution_clock::now();
+
+    std::chrono::duration<double, std::milli> serial_duration = t2 - t1;
+    std::chrono::duration<double, std::milli> batch_duration = t4 - t3;
+
+    std::cout << bold_on << "test: " << bold_off << title << "\n";
+    std::cout << bold_on << "batch size: " << bold_off << batch_size << "\n";
+    std::cout << bold_on << "found serial / batch: " << bold_off << serial_found_count << " / " << batch_found_count
+              << "\n";
+    std::cout << bold_on << "probes serial / batch: " << bold_off << serial_probes_count << " / "
+              << batch_probes_count << "\n";
+    std::cout << bold_on << "total time of serial searches: " << bold_off << serial_duration.count() << "ms" << "\n";
+    std::cout << bold_on << "total time of batch searches: " << bold_off << batch_duration.count() << "ms" << "\n\n";
+    std::cout << std::endl;
+}
+
+// keys are looked up through views into a separate buffer, like keys parsed out of a
+// request; without a transparent hasher every lookup has to build a std::string first
+template<template<typename, typename, template<typename> typename, double> typename H,
+        template<typename> typename Hasher>
+void test_string_lookup(std::string_view title, std::size_t count) {
+    H<std::string, std::size_t, Hasher, 0.8> hash_table;
+    std::string buffer;
+
+    for (std::size_t i = 0; i < count; ++i) {
+        std::string key = "string key number " + std::to_string(i);
+        buffer += key;
+        hash_table.insert({std::move(key), i});
+    }
+
+    std::vector<std::string_view> views;
+    std::string_view rest = buffer;
+
+    for (std::size_t i = 0; i < count; ++i) {
+        std::size_t length = ("string key number " + std::to_string(i)).size();
+        views.push_back(rest.substr(0, length));
+        rest.remove_prefix(length);
+    }
+
+    std::size_t found_count = 0;
+    std::size_t probes_count = 0;
+    std::size_t allocations_before = allocations_count;
+
+    auto t1 = std::chrono::high_resolution_clock::now();
+    for (auto view: views) {
+        if constexpr (TransparentHash<Hasher, std::string, std::string_view>) {
+            found_count += hash_table.find(view, probes_count).has_value();
+        } else {
+            found_count += hash_table.find(std::string(view), probes_count).has_value();
+        }
+    }
+    auto t2 = std::chrono::high_resolution_clock::now();
+
+    std::size_t allocations = allocations_count - allocations_before;
+    std::chrono::duration<double, std::milli> duration = t2 - t1;
+
+    std::cout << bold_on << "test: " << bold_off << title << "\n";
+    std::cout << bold_on << "found: " << bold_off << found_count << " / " << count << "\n";
+    std::cout << bold_on << "allocations per lookup: " << bold_off
+              << static_cast<double>(allocations) / static_cast<double>(count) << "\n";
+    std::cout << bold_on << "total time of searches: " << bold_off << duration.count() << "ms" << "\n\n";
+    std::cout << std::endl;
+}
+
+// keys are moved into the table and should never be copied again, not even when it grows;
+// try_emplace with a key that is already present must not construct or allocate anything
+template<template<typename, typename, template<typename> typename, double> typename H>
+void test_key_copies(std::string_view title, std::size_t count) {
+    H<CountedKey, std::vector<std::size_t>, StdHasher, 0.8> hash_table;
+    std::vector<CountedKey> keys;
+
+    for (std::size_t i = 0; i < count; ++i) {
+        keys.emplace_back("string key number " + std::to_string(i));
+    }
+
+    CountedKey::copies = 0;
+
+    auto t1 = std::chrono::high_resolution_clock::now();
+    for (std::size_t i = 0; i < count; ++i) {
+        hash_table.try_emplace(CountedKey(keys[i].value), 16, i);
+    }
+    auto t2 = std::chrono::high_resolution_clock::now();
+
+    std::size_t insert_copies = CountedKey::copies;
+    std::size_t allocations_before = allocations_count;
+
+    std::size_t inserted_count = 0;
+    for (const CountedKey &key: keys) {
+        inserted_count += hash_table.try_emplace(key, 16, 0);
+    }
+
+    std::size_t allocations = allocations_count - allocations_before;
+    std::chrono::duration<double, std::milli> duration = t2 - t1;
+
+    std::cout << bold_on << "test: " << bold_off << title << "\n";
+    std::cout << bold_on << "key copies while inserting and growing: " << bold_off << insert_copies << "\n";
+    std::cout << bold_on << "present keys inserted again: " << bold_off << inserted_count << "\n";
+    std::cout << bold_on << "allocations of try_emplace on present keys: " << bold_off << allocations << "\n";
+    std::cout << bold_on << "total time of inserts: " << bold_off << duration.count() << "ms" << "\n\n";
+    std::cout << std::endl;
+}
+
+// the stats of a table in use against the analytic estimates, lookups as in test
+template<typename Table>
+void test_live_stats(std::string_view title, const std::unordered_set<std::size_t> &random_numbers) {
+    Table hash_table;
+
+    for (auto number: random_numbers) {
+        hash_table.insert({number, number});
+    }
+
+    for (auto number: random_numbers) {
+        if (number % 4 == 0) {
+            hash_table.remove(number);
+        }
+    }
+
+    for (std::size_t i = 0; i < 1'000'000; ++i) {
+        hash_table.find(i);
+    }
+
+    TableStats stats = hash_table.stats();
+
+    std::cout << bold_on << "test: " << bold_off << title << "\n";
+    std::cout << bold_on << "load factor: " << bold_off << hash_table.load_factor() << "\n";
+    std::cout << bold_on << "average probes count of successful search: " << bold_off
+              << stats.average_successful_probes() << ", " << bold_on << "evaluation: " << bold_off
+              << hash_table.successful_probes_evaluation() << "\n";
+    std::cout << bold_on << "average probes count of failed search: " << bold_off << stats.average_failed_probes()
+              << ", " << bold_on << "evaluation: " << bold_off << hash_table.failed_probes_evaluation() << "\n";
+    std::cout << bold_on << "max probes count: " << bold_off << stats.max_probes << "\n";
+    std::cout << bold_on << "failed searches by probes count: " << bold_off;
+    for (std::size_t count: stats.failed_histogram) {
+        std::cout << count << " ";
+    }
+    std::cout << "\n";
+    std::cout << bold_on << "tombstones: " << bold_off << stats.tombstones << "\n";
+    std::cout << bold_on << "rehashes: " << bold_off << stats.rehash_count << ", " << bold_on << "total time: "
+              << bold_off << std::chrono::duration<double, std::milli>(stats.rehash_time).count() << "ms" << "\n";
+    std::cout << bold_on << "allocated: " << bold_off << static_cast<double>(stats.allocated_bytes) / (1 << 20)
+              << "MiB" << "\n\n";
+    std::cout << std::endl;
+}
+
+// saves a table and maps it back: the load itself, then the first pass of lookups that
+// pages the file in
+template<template<typename, typename, template<typename> typename, double> typename H>
+void test_snapshot(std::string_view title, const std::unordered_set<std::size_t> &random_numbers,
+                   const std::filesystem::path &path) {
+    H<std::size_t, std::size_t, StdHasher, 0.8> saved;
+
+    for (auto number: random_numbers) {
+        saved.insert({number, number});
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    bool ok = saved.save(path);
+    auto saved_at = std::chrono::high_resolution_clock::now();
+
+    H<std::size_t, std::size_t, StdHasher, 0.8> loaded;
+    ok = ok && loaded.load(path);
+    auto loaded_at = std::chrono::high_resolution_clock::now();
+
+    for (auto number: random_numbers) {
+        auto kv = loaded.find(number);
+        ok = ok && kv && kv->get().second == number;
+    }
+
+    auto found_at = std::chrono::high_resolution_clock::now();
+
+    std::cout << bold_on << "test: " << bold_off << title << "\n";
+    std::cout << bold_on << "entries: " << bold_off << loaded.fullness() << ", " << bold_on << "ok: " << bold_off
+              << ok << "\n";
+    std::cout << bold_on << "save: " << bold_off
+              << std::chrono::duration<double, std::milli>(saved_at - start).count() << "ms, " << bold_on
+              << "load: " << bold_off << std::chrono::duration<double, std::milli>(loaded_at - saved_at).count()
+              << "ms, " << bold_on << "first lookups: " << bold_off
+              << std::chrono::duration<double, std::milli>(found_at - loaded_at).count() << "ms" << "\n\n";
+    std::cout << std::endl;
+
+    std::filesystem::remove(path);
+}
+
+// time of growing a table of count entries by one capacity step, on the calling thread
+// (0 threads) and on thread_rehash_executor with each of the thread counts
+template<template<typename, typename, template<typename> typename, double> typename H>
+void test_parallel_rehash(std::string_view title, std::size_t count, std::span<const std::size_t> thread_counts) {
+    std::cout << bold_on << "test: " << bold_off << title << "\n";
+    std::cout << bold_on << "entries: " << bold_off << count << "\n";
+
+    for (std::size_t thread_count: thread_counts) {
+        auto hash_table = std::make_unique<H<std::size_t, std::size_t, StdHasher, 0.8>>();
+        hash_table->reserve(count);
+
+        for (std::size_t i = 0; i < count; ++i) {
+            hash_table->insert({i * 0x9E3779B97F4A7C15ull, i});
+        }
+
+        if (thread_count) {
+            hash_table->set_rehash_executor(thread_rehash_executor(thread_count));
+        }
+
+        std::size_t old_size = hash_table->size();
+        auto start = std::chrono::high_resolution_clock::now();
+        hash_table->reserve(old_size);
+        auto end = std::chrono::high_resolution_clock::now();
+
+        std::cout << bold_on << "threads: " << bold_off << thread_count << ", " << bold_on << "slots: " << bold_off
+                  << old_size << " -> " << hash_table->size() << ", " << bold_on << "time: " << bold_off
+                  << std::chrono::duration<double, std::milli>(end - start).count() << "ms" << "\n";
+    }
+
+    std::cout << std::endl;
+}
+
+// time of summing the values of count entries spread over sparsity times as many slots
+// as they need, by a range for and by parallel_for_each with each of the thread counts
+template<template<typename, typename, template<typename> typename, double> typename H>
+void test_iteration(std::string_view title, std::size_t count, std::size_t sparsity,
+                    std::span<const std::size_t> thread_counts) {
+    static_assert(std::ranges::forward_range<H<std::size_t, std::size_t, StdHasher, 0.8>>);
+
+    std::cout << bold_on << "test: " << bold_off << title << "\n";
+
+    auto hash_table = std::make_unique<H<std::size_t, std::size_t, StdHasher, 0.8>>();
+    hash_table->reserve(count * sparsity);
+
+    for (std::size_t i = 0; i < count; ++i) {
+        hash_table->insert({i * 0x9E3779B97F4A7C15ull, i});
+    }
+
+    std::cout << bold_on << "entries: " << bold_off << count << ", " << bold_on << "slots: " << bold_off
+              << hash_table->size() << "\n";
+
+    std::size_t expected = count * (count - 1) / 2;
+    std::size_t sum = 0;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (const auto &[key, value]: *hash_table) {
+        sum += value;
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+
+    assert(sum == expected);
+    std::cout << bold_on << "range for: " << bold_off
+              << std::chrono::duration<double, std::milli>(end - start).count() << "ms" << "\n";
+
+    for (std::size_t thread_count: thread_counts) {
+        std::atomic<std::size_t> parallel_sum = 0;
+
+        start = std::chrono::high_resolution_clock::now();
+        hash_table->parallel_for_each([&](const auto &kv) {
+            parallel_sum.fetch_add(kv.second, std::memory_order_relaxed);
+        }, thread_count);
+        end = std::chrono::high_resolution_clock::now();
+
+        assert(parallel_sum == expected);
+        std::cout << bold_on << "threads: " << bold_off << thread_count << ", " << bold_on << "time: " << bold_off
+                  << std::chrono::duration<double, std::milli>(end - start).count() << "ms" << "\n";
+    }
+
+    std::cout << std::endl;
+}
+
+// resident set size in bytes, 0 where /proc is not available
+std::size_t resident_memory() {
+    std::ifstream statm("/proc/self/statm");
+    std::size_t total_pages = 0;
+    std::size_t resident_pages = 0;
+
+    statm >> total_pages >> resident_pages;
+    return resident_pages * 4096;
+}
+
+template<template<typename, typename, template<typename> typename, double> typename H>
+void test_allocation(std::string_view title, std::size_t count) {
+    std::size_t memory_before = resident_memory();
+    auto hash_table = std::make_unique<H<std::size_t, std::size_t, StdHasher, 0.8>>();
+
+    auto t1 = std::chrono::high_resolution_clock::now();
+    for (std::size_t i = 0; i < count; ++i) {
+        hash_table->insert({i, i});
+    }
+    auto t2 = std::chrono::high_resolution_clock::now();
+
+    std::size_t memory_after = resident_memory();
+
+    auto t3 = std::chrono::high_resolution_clock::now();
+    hash_table.reset();
+    auto t4 = std::chrono::high_resolution_clock::now();
+
+    std::chrono::duration<double, std::milli> insert_duration = t2 - t1;
+    std::chrono::duration<double, std::milli> teardown_duration = t4 - t3;
+
+    std::cout << bold_on << "test: " << bold_off << title << "\n";
+    std::cout << bold_on << "inserts: " << bold_off << count << "\n";
+    std::cout << bold_on << "insert throughput: " << bold_off
+              << static_cast<double>(count) / insert_duration.count() / 1000 << "M/s" << "\n";
+    std::cout << bold_on << "teardown time: " << bold_off << teardown_duration.count() << "ms" << "\n";
+    std::cout << bold_on << "resident memory growth: " << bold_off
+              << static_cast<double>(memory_after - memory_before) / (1 << 20) << "MiB" << "\n\n";
+    std::cout << std::endl;
+}
+
+// a burst of count entries of which one in keep_one_in stays: capacity and resident memory
+// after the removes, after shrink_to_fit, and with the same removes under an automatic shrink
+template<template<typename, typename, template<typename> typename, double> typename H>
+void test_shrink(std::string_view title, std::size_t count, std::size_t keep_one_in) {
+    std::cout << bold_on << "test: " << bold_off << title << "\n";
+
+    auto report = [](std::string_view step, auto &hash_table) {
+        std::cout << bold_on << step << ": " << bold_off << "slots: " << hash_table.size() << ", "
+                  << bold_on << "resident memory: " << bold_off
+                  << static_cast<double>(resident_memory()) / (1 << 20) << "MiB" << "\n";
+    };
+
+    for (bool automatic: {false, true}) {
+        auto hash_table = std::make_unique<H<std::size_t, std::size_t, FastHasher, 0.8>>();
+
+        if (automatic) {
+            hash_table->set_shrink_load_factor(0.2);
+        }
+
+        for (std::size_t i = 0; i < count; ++i) {
+            hash_table->insert({i, i});
+        }
+
+        report(automatic ? "automatic, burst" : "burst", *hash_table);
+
+        auto start = std::chrono::high_resolution_clock::now();
+        for (std::size_t i = 0; i < count; ++i) {
+            if (i % keep_one_in) {
+                hash_table->remove(i);
+            }
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+
+        report(automatic ? "automatic, removed" : "removed", *hash_table);
+        std::cout << bold_on << "remove time: " << bold_off
+                  << std::chrono::duration<double, std::milli>(end - start).count() << "ms" << "\n";
+
+        if (!automatic) {
+            start = std::chrono::high_resolution_clock::now();
+            hash_table->shrink_to_fit();
+            end = std::chrono::high_resolution_clock::now();
+
+            report("shrink_to_fit", *hash_table);
+            std::cout << bold_on << "shrink time: " << bold_off
+                      << std::chrono::duration<double, std::milli>(end - start).count() << "ms" << "\n";
+        }
+
+        for (std::size_t i = 0; i < count; i += keep_one_in) {
+            assert(hash_table->contains(i));
+        }
+    }
+
+    std::cout << std::endl;
+}
+
+// count inserts into flat linear probing with sizes growing by the Capacity's factor: slots
+// per entry at the end, and at worst while a rehash holds both the old and the new table
+template<typename Capacity>
+void test_growth(std::string_view title, std::size_t count) {
+    LinearHashingHashTable<std::size_t, std::size_t, FastHasher, 0.8, FlatSlotStorage, Capacity> hash_table;
+    double peak_slots_per_entry = 0;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (std::size_t i = 0; i < count; ++i) {
+        std::size_t slots = hash_table.size();
+        hash_table.insert({i, i});
+
+        if (hash_table.size() != slots) {
+            peak_slots_per_entry = std::max(peak_slots_per_entry, static_cast<double>(slots + hash_table.size()) /
+                                                                  static_cast<double>(hash_table.fullness()));
+        }
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+
+    std::cout << bold_on << "test: " << bold_off << title << "\n";
+    std::cout << bold_on << "growth steps: " << bold_off << Capacity::count << "\n";
+    std::cout << bold_on << "insert throughput: " << bold_off
+              << static_cast<double>(count) / std::chrono::duration<double, std::milli>(end - start).count() / 1000
+              << "M/s" << "\n";
+    std::cout << bold_on << "slots per entry: " << bold_off
+              << static_cast<double>(hash_table.size()) / static_cast<double>(count) << "\n";
+    std::cout << bold_on << "peak slots per entry: " << bold_off << peak_slots_per_entry << "\n";
+    std::cout << std::endl;
+}
+
+// every thread works on random keys of [0, 2 * count), a table prefilled with every even key,
+// read_percent of the operations are finds, the rest are inserts and removes in equal parts
+template<typename Table>
+void test_concurrency(std::string_view title, std::size_t count, std::span<const std::size_t> thread_counts,
+                      std::size_t read_percent) {
+    std::cout << bold_on << "test: " << bold_off << title << "\n";
+    std::cout << bold_on << "reads: " << bold_off << read_percent << "%" << "\n";
+
+    for (std::size_t thread_count: thread_counts) {
+        auto hash_table = std::make_unique<Table>();
+
+        for (std::size_t i = 0; i < count; ++i) {
+            hash_table->insert({2 * i, i});
+        }
+
+        std::size_t operations_per_thread = 4 * count / thread_count;
+        std::latch start(static_cast<std::ptrdiff_t>(thread_count) + 1);
+        std::vector<std::jthread> threads;
+
+        for (std::size_t t = 0; t < thread_count; ++t) {
+            threads.emplace_back([&, t] {
+                std::mt19937_64 random(t);
+                std::size_t found_count = 0;
+
+                start.arrive_and_wait();
+
+                for (std::size_t i = 0; i < operations_per_thread; ++i) {
+                    std::size_t key = random() % (2 * count);
+                    std::size_t operation = random() % 100;
+
+                    if (operation < read_percent) {
+                        found_count += hash_table->find(key).has_value();
+                    } else if (operation % 2 == 0) {
+                        hash_table->insert({key, i});
+                    } else {
+                        hash_table->remove(key);
+                    }
+                }
+
+                assert(found_count <= operations_per_thread);
+            });
+        }
+
+        auto t1 = std::chrono::high_resolution_clock::now();
+        start.arrive_and_wait();
+        threads.clear();
+        auto t2 = std::chrono::high_resolution_clock::now();
+
+        std::chrono::duration<double, std::milli> duration = t2 - t1;
+
+        std::cout << bold_on << "threads: " << bold_off << thread_count << ", " << bold_on << "throughput: "
+                  << bold_off << static_cast<double>(operations_per_thread * thread_count) / duration.count() / 1000
+                  << "M/s" << "\n";
+    }
+
+    std::cout << std::endl;
+}
+
+// readers find random keys of [0, 2 * count) in a table prefilled with every even key, while
+// one writer assigns, removes and inserts writes_per_second random keys a second
+template<typename Table>
+void test_read_mostly(std::string_view title, std::size_t count, std::span<const std::size_t> thread_counts,
+                      std::size_t writes_per_second) {
+    std::cout << bold_on << "test: " << bold_off << title << "\n";
+    std::cout << bold_on << "writes: " << bold_off << writes_per_second << "/s" << "\n";
+
+    for (std::size_t thread_count: thread_counts) {
+        auto hash_table = std::make_unique<Table>();
+
+        for (std::size_t i = 0; i < count; ++i) {
+            hash_table->insert({2 * i, i});
+        }
+
+        std::size_t operations_per_thread = 4 * count;
+        std::latch start(static_cast<std::ptrdiff_t>(thread_count) + 2);
+        std::atomic<bool> stop = false;
+        std::atomic<std::size_t> errors_count = 0;
+        std::size_t writes_count = 0;
+        std::vector<std::jthread> threads;
+
+        // values stay key / 2 for every even key, a reader finding another one saw a torn entry
+        std::jthread writer([&] {
+            std::mt19937_64 random(thread_count);
+            auto next_write = std::chrono::steady_clock::now();
+
+            start.arrive_and_wait();
+
+            while (!stop) {
+                std::size_t key = random() % (2 * count);
+
+                if (key % 2 == 0) {
+                    hash_table->insert_or_assign(key, key / 2);
+                } else if (!hash_table->remove(key)) {
+                    hash_table->insert({key, key});
+                }
+
+                ++writes_count;
+                next_write += std::chrono::nanoseconds(1'000'000'000 / writes_per_second);
+                std::this_thread::sleep_until(next_write);
+            }
+        });
+
+        for (std::size_t t = 0; t < thread_count; ++t) {
+            threads.emplace_back([&, t] {
+                std::mt19937_64 random(t);
+                std::size_t errors = 0;
+
+                start.arrive_and_wait();
+
+                for (std::size_t i = 0; i < operations_per_thread; ++i) {
+                    std::size_t key = random() % (2 * count);
+                    auto value = hash_table->find(key);
+
+                    errors += key % 2 == 0 ? value != std::optional<std::size_t>(key / 2) : value && *value != key;
+                }
+
+                errors_count += errors;
+            });
+        }
+
+        auto t1 = std::chrono::high_resolution_clock::now();
+        start.arrive_and_wait();
+        threads.clear();
+        auto t2 = std::chrono::high_resolution_clock::now();
+
+        stop = true;
+        writer.join();
+
+        std::chrono::duration<double, std::milli> duration = t2 - t1;
+
+        std::cout << bold_on << "threads: " << bold_off << thread_count << ", " << bold_on << "find throughput: "
+                  << bold_off << static_cast<double>(operations_per_thread * thread_count) / duration.count() / 1000
+                  << "M/s, " << bold_on << "writes: " << bold_off << writes_count << ", " << bold_on << "errors: "
+                  << bold_off << errors_count << "\n";
+    }
+
+    std::cout << std::endl;
+}
+
+// every thread inserts, checks and removes its own keys while readers check a fixed key set,
+// through all the resizes a table growing from its minimal size goes through
+template<typename Table>
+void test_concurrency_stress(std::string_view title, std::size_t count, std::size_t thread_count) {
+    auto hash_table = std::make_unique<Table>();
+    std::size_t fixed_count = count / 10;
+    std::atomic<std::size_t> errors_count = 0;
+
+    for (std::size_t i = 0; i < fixed_count; ++i) {
+        hash_table->insert({count * thread_count + i, i});
+    }
+
+    auto t1 = std::chrono::high_resolution_clock::now();
+    {
+        std::atomic<bool> stop = false;
+        std::vector<std::jthread> readers;
+        std::vector<std::jthread> writers;
+
+        for (std::size_t t = 0; t < 2; ++t) {
+            readers.emplace_back([&] {
+                while (!stop) {
+                    for (std::size_t i = 0; i < fixed_count; ++i) {
+                        errors_count += hash_table->find(count * thread_count + i) != std::optional<std::size_t>(i);
+                    }
+                }
+            });
+        }
+
+        for (std::size_t t = 0; t < thread_count; ++t) {
+            writers.emplace_back([&, t] {
+                for (std::size_t i = 0; i < count; ++i) {
+                    errors_count += !hash_table->insert({i * thread_count + t, i});
+                }
+
+                for (std::size_t i = 0; i < count; ++i) {
+                    errors_count += hash_table->find(i * thread_count + t) != std::optional<std::size_t>(i);
+                    errors_count += hash_table->insert({i * thread_count + t, 0});
+                }
+
+                for (std::size_t i = 0; i < count; ++i) {
+                    auto kv = hash_table->remove(i * thread_count + t);
+                    errors_count += !kv || kv->second != i;
+                    errors_count += hash_table->find(i * thread_count + t).has_value();
+                }
+            });
+        }
+
+        writers.clear();
+        stop = true;
+    }
+    auto t2 = std::chrono::high_resolution_clock::now();
+
+    errors_count += hash_table->fullness() != fixed_count;
+
+    std::chrono::duration<double, std::milli> duration = t2 - t1;
+
+    std::cout << bold_on << "test: " << bold_off << title << "\n";
+    std::cout << bold_on << "threads: " << bold_off << thread_count << "\n";
+    std::cout << bold_on << "errors: " << bold_off << errors_count << "\n";
+    std::cout << bold_on << "total time: " << bold_off << duration.count() << "ms" << "\n\n";
+    std::cout << std::endl;
+}
+
+// writers insert new keys while a table emptied of count prefilled keys is shrunk over and
+// over, the first shrink migrates the large table into a minimal one while they insert
+template<typename Table>
+void test_concurrent_shrink(std::string_view title, std::size_t count, std::size_t thread_count) {
+    auto hash_table = std::make_unique<Table>();
+    std::atomic<std::size_t> errors_count = 0;
+    std::atomic<std::size_t> shrinks_count = 0;
+
+    for (std::size_t i = 0; i < count; ++i) {
+        hash_table->insert({i, i});
+    }
+
+    for (std::size_t i = 0; i < count; ++i) {
+        errors_count += !hash_table->remove(i);
+    }
+
+    auto t1 = std::chrono::high_resolution_clock::now();
+    {
+        std::atomic<bool> stop = false;
+        std::vector<std::jthread> writers;
+
+        std::jthread shrinker([&] {
+            while (!stop) {
+                hash_table->shrink_to_fit();
+                ++shrinks_count;
+            }
+        });
+
+        for (std::size_t t = 0; t < thread_count; ++t) {
+            writers.emplace_back([&, t] {
+                for (std::size_t i = 0; i < count; ++i) {
+                    std::size_t key = count + i * thread_count + t;
+
+                    errors_count += !hash_table->insert({key, i});
+
+                    if (i % 2) {
+                        errors_count += !hash_table->remove(key);
+                    }
+                }
+            });
+        }
+
+        writers.clear();
+        stop = true;
+    }
+    auto t2 = std::chrono::high_resolution_clock::now();
+
+    for (std::size_t t = 0; t < thread_count; ++t) {
+        for (std::size_t i = 0; i < count; ++i) {
+            std::size_t key = count + i * thread_count + t;
+            errors_count += hash_table->find(key) != (i % 2 ? std::nullopt : std::optional<std::size_t>(i));
+        }
+    }
+
+    errors_count += hash_table->fullness() != thread_count * ((count + 1) / 2);
+
+    std::chrono::duration<double, std::milli> duration = t2 - t1;
+
+    std::cout << bold_on << "test: " << bold_off << title << "\n";
+    std::cout << bold_on << "threads: " << bold_off << thread_count << "\n";
+    std::cout << bold_on << "shrinks: " << bold_off << shrinks_count << "\n";
+    std::cout << bold_on << "errors: " << bold_off << errors_count << "\n";
+    std::cout << bold_on << "total time: " << bold_off << duration.count() << "ms" << "\n\n";
+    std::cout << std::endl;
+}
+
 int main() {
 //    auto random_numbers = generate_rand_numbers<1'000'000>(0, 1'000'000);
     auto random_numbers = generate_rand_numbers<15>(0, 1'000'000);
@@ -198,10 +1035,142 @@ int main() {
     test_deletion<DoubleHashingHashTable>("double hashing hash table", random_numbers);
     test_deletion<LinearHashingHashTable>("linear probing hash table", random_numbers);
     test_deletion<BucketHashTable>("bucket hash table", random_numbers);
+    test_deletion<IncrementalBucketHashTable>("incremental bucket hash table", random_numbers);
+    test_deletion<PoolBucketHashTable>("pool bucket hash table", random_numbers);
+    test_deletion<PoolLinearHashingHashTable>("pool linear probing hash table", random_numbers);
+    test_deletion<FlatDoubleHashingHashTable>("flat double hashing hash table", random_numbers);
+    test_deletion<FlatLinearHashingHashTable>("flat linear probing hash table", random_numbers);
+    test_deletion<GroupProbingHashTable>("group probing hash table", random_numbers);
+    test_deletion<RobinHoodHashingHashTable>("robin hood hashing hash table", random_numbers);
+    test_deletion<CuckooHashTable>("cuckoo hash table", random_numbers);
 
 //    test_series<DoubleHashingHashTable, 50'000, true>("double hashing hash table", random_numbers);
 //    test_series<LinearHashingHashTable, 50'000, true>("linear probing hash table", random_numbers);
 //    test_series<BucketHashTable, 50'000, false>("bucket hash table", random_numbers);
+//    test_series<FlatDoubleHashingHashTable, 50'000, true>("flat double hashing hash table", random_numbers);
+//    test_series<FlatLinearHashingHashTable, 50'000, true>("flat linear probing hash table", random_numbers);
+//    test_series<GroupProbingHashTable, 50'000, true>("group probing hash table", random_numbers);
+//    test_series<RobinHoodHashingHashTable, 50'000, true>("robin hood hashing hash table", random_numbers);
+//    test_series<CuckooHashTable, 50'000, true>("cuckoo hash table", random_numbers);
+
+//    test_insert_latency<BucketHashTable>("bucket hash table", 10'000'000);
+//    test_insert_latency<IncrementalBucketHashTable>("incremental bucket hash table", 10'000'000);
+
+//    test_allocation<BucketHashTable>("bucket hash table", 10'000'000);
+//    test_allocation<PoolBucketHashTable>("pool bucket hash table", 10'000'000);
+//    test_allocation<LinearHashingHashTable>("linear probing hash table", 10'000'000);
+//    test_allocation<PoolLinearHashingHashTable>("pool linear probing hash table", 10'000'000);
+//    test_allocation<DoubleHashingHashTable>("double hashing hash table", 10'000'000);
+//    test_allocation<PoolDoubleHashingHashTable>("pool double hashing hash table", 10'000'000);
+
+//    test_find_batch<FlatLinearHashingHashTable>("flat linear probing hash table", random_numbers, 64);
+//    test_find_batch<DoubleHashingHashTable>("double hashing hash table", random_numbers, 64);
+//    test_find_batch<BucketHashTable>("bucket hash table", random_numbers, 64);
+//    test_find_batch<GroupProbingHashTable>("group probing hash table", random_numbers, 64);
+//    test_find_batch<CuckooHashTable>("cuckoo hash table", random_numbers, 64);
+
+//    std::array<std::size_t, 6> thread_counts{1, 2, 4, 8, 16, 32};
+//    for (std::size_t read_percent: {50, 90, 100}) {
+//        test_concurrency<ShardedHashTable<FlatLinearHashingHashTable<std::size_t, std::size_t, StdHasher, 0.8>, 1>>(
+//                "flat linear probing hash table, single lock", 1'000'000, thread_counts, read_percent);
+//        test_concurrency<ShardedHashTable<FlatLinearHashingHashTable<std::size_t, std::size_t, StdHasher, 0.8>>>(
+//                "flat linear probing hash table, 64 shards", 1'000'000, thread_counts, read_percent);
+//        test_concurrency<ShardedHashTable<FlatLinearHashingHashTable<std::size_t, std::size_t, StdHasher, 0.8>,
+//                64, SpinLock>>("flat linear probing hash table, 64 spin locked shards", 1'000'000, thread_counts,
+//                               read_percent);
+//        test_concurrency<ShardedHashTable<DoubleHashingHashTable<std::size_t, std::size_t, StdHasher, 0.8>>>(
+//                "double hashing hash table, 64 shards", 1'000'000, thread_counts, read_percent);
+//        test_concurrency<ShardedHashTable<BucketHashTable<std::size_t, std::size_t, StdHasher, 0.8>>>(
+//                "bucket hash table, 64 shards", 1'000'000, thread_counts, read_percent);
+//    }
+
+//    test_string_lookup<FlatLinearHashingHashTable, StdHasher>("flat linear probing hash table, std::string keys",
+//                                                              1'000'000);
+//    test_string_lookup<FlatLinearHashingHashTable, TransparentStringHasher>(
+//            "flat linear probing hash table, std::string_view lookups", 1'000'000);
+//    test_string_lookup<BucketHashTable, StdHasher>("bucket hash table, std::string keys", 1'000'000);
+//    test_string_lookup<BucketHashTable, TransparentStringHasher>("bucket hash table, std::string_view lookups",
+//                                                                 1'000'000);
+//    test_string_lookup<GroupProbingHashTable, StdHasher>("group probing hash table, std::string keys", 1'000'000);
+//    test_string_lookup<GroupProbingHashTable, TransparentStringHasher>(
+//            "group probing hash table, std::string_view lookups", 1'000'000);
+
+//    std::array<std::size_t, 7> thread_counts{1, 2, 4, 8, 16, 32, 64};
+//    for (std::size_t read_percent: {50, 90, 100}) {
+//        test_concurrency<ShardedHashTable<LinearHashingHashTable<std::size_t, std::size_t, StdHasher, 0.5>, 1,
+//                std::mutex>>("linear probing hash table, single mutex", 1'000'000, thread_counts, read_percent);
+//        test_concurrency<ConcurrentLinearHashingHashTable<std::size_t, std::size_t, StdHasher>>(
+//                "lock-free linear probing hash table", 1'000'000, thread_counts, read_percent);
+//    }
+//    for (std::size_t thread_count: {1, 4, 16, 64}) {
+//        test_concurrency_stress<ShardedHashTable<LinearHashingHashTable<std::size_t, std::size_t, StdHasher, 0.5>, 1,
+//                std::mutex>>("linear probing hash table, single mutex", 100'000, thread_count);
+//        test_concurrency_stress<ConcurrentLinearHashingHashTable<std::size_t, std::size_t, StdHasher>>(
+//                "lock-free linear probing hash table", 100'000, thread_count);
+//    }
+//    for (std::size_t thread_count: {1, 4, 16}) {
+//        test_concurrent_shrink<ConcurrentLinearHashingHashTable<std::size_t, std::size_t, StdHasher>>(
+//                "lock-free linear probing hash table", 200'000, thread_count);
+//    }
+
+//    std::array<std::size_t, 6> thread_counts{1, 2, 4, 8, 16, 32};
+//    for (std::size_t writes_per_second: {10, 10'000}) {
+//        test_read_mostly<ShardedHashTable<FlatLinearHashingHashTable<std::size_t, std::size_t, FastHasher, 0.8>, 1>>(
+//                "flat linear probing hash table, shared_mutex", 1'000'000, thread_counts, writes_per_second);
+//        test_read_mostly<ReadMostlyFlatLinearHashingHashTable<std::size_t, std::size_t, FastHasher, 0.8>>(
+//                "flat linear probing hash table, read-mostly", 1'000'000, thread_counts, writes_per_second);
+//        test_read_mostly<ReadMostlyBucketHashTable<std::size_t, std::size_t, FastHasher, 0.8>>(
+//                "bucket hash table, read-mostly", 1'000'000, thread_counts, writes_per_second);
+//    }
+
+//    test_key_copies<LinearHashingHashTable>("linear probing hash table", 1'000'000);
+//    test_key_copies<FlatLinearHashingHashTable>("flat linear probing hash table", 1'000'000);
+//    test_key_copies<DoubleHashingHashTable>("double hashing hash table", 1'000'000);
+//    test_key_copies<BucketHashTable>("bucket hash table", 1'000'000);
+//    test_key_copies<IncrementalBucketHashTable>("incremental bucket hash table", 1'000'000);
+//    test_key_copies<GroupProbingHashTable>("group probing hash table", 1'000'000);
+//    test_key_copies<RobinHoodHashingHashTable>("robin hood hashing hash table", 1'000'000);
+
+//    test_live_stats<LinearHashingHashTable<std::size_t, std::size_t, StdHasher, 0.8, FlatSlotStorage, PrimeCapacity,
+//            std::allocator<std::pair<const std::size_t, std::size_t>>, CollectStats>>(
+//            "flat linear probing hash table", random_numbers);
+//    test_live_stats<DoubleHashingHashTable<std::size_t, std::size_t, StdHasher, 0.8, FlatSlotStorage, PrimeCapacity,
+//            std::allocator<std::pair<const std::size_t, std::size_t>>, CollectStats>>(
+//            "flat double hashing hash table", random_numbers);
+//    test_live_stats<GroupProbingHashTable<std::size_t, std::size_t, StdHasher, 0.875, PrimeCapacity, CollectStats>>(
+//            "group probing hash table", random_numbers);
+//    test_live_stats<RobinHoodHashingHashTable<std::size_t, std::size_t, StdHasher, 0.9, FlatSlotStorage,
+//            PrimeCapacity, std::allocator<std::pair<const std::size_t, std::size_t>>, CollectStats>>(
+//            "robin hood hashing hash table", random_numbers);
+
+//    std::array<std::size_t, 6> rehash_thread_counts{0, 1, 2, 4, 8, 16};
+//    for (std::size_t count: {10'000'000, 100'000'000}) {
+//        test_parallel_rehash<FlatLinearHashingHashTable>("flat linear probing hash table", count, rehash_thread_counts);
+//        test_parallel_rehash<FlatDoubleHashingHashTable>("flat double hashing hash table", count, rehash_thread_counts);
+//        test_parallel_rehash<LinearHashingHashTable>("linear probing hash table", count, rehash_thread_counts);
+//        test_parallel_rehash<BucketHashTable>("bucket hash table", count, rehash_thread_counts);
+//    }
+
+//    test_snapshot<FlatLinearHashingHashTable>("flat linear probing hash table", random_numbers, "linear.snapshot");
+//    test_snapshot<FlatDoubleHashingHashTable>("flat double hashing hash table", random_numbers, "double.snapshot");
+
+//    std::array<std::size_t, 4> iteration_thread_counts{1, 2, 4, 8};
+//    for (std::size_t sparsity: {1, 16}) {
+//        test_iteration<FlatLinearHashingHashTable>("flat linear probing hash table", 1'000'000, sparsity,
+//                                                   iteration_thread_counts);
+//        test_iteration<GroupProbingHashTable>("group probing hash table", 1'000'000, sparsity, iteration_thread_counts);
+//        test_iteration<BucketHashTable>("bucket hash table", 1'000'000, sparsity, iteration_thread_counts);
+//        test_iteration<CuckooHashTable>("cuckoo hash table", 1'000'000, sparsity, iteration_thread_counts);
+//    }
+
+//    test_shrink<FlatLinearHashingHashTable>("flat linear probing hash table", 50'000'000, 1000);
+//    test_shrink<FlatDoubleHashingHashTable>("flat double hashing hash table", 50'000'000, 1000);
+//    test_shrink<BucketHashTable>("bucket hash table", 50'000'000, 1000);
+//    test_shrink<GroupProbingHashTable>("group probing hash table", 50'000'000, 1000);
+
+//    test_growth<PrimeGrowthCapacity<2, 1>>("prime sizes, 2x growth", 30'000'000);
+//    test_growth<PrimeGrowthCapacity<3, 2>>("prime sizes, 1.5x growth", 30'000'000);
+//    test_growth<PrimeGrowthCapacity<5, 4>>("prime sizes, 1.25x growth", 30'000'000);
 
     return 0;
 }